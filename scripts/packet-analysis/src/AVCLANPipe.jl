@@ -3,6 +3,8 @@ module AVCLANPipe
 using PcapTools, Dates, UnixTimes
 
 export AVCLANframe, avclan_text_to_pcap, tobytes
+export CaptureRecord, CAPTURE_FRAME, CAPTURE_STATS, CAPTURE_REPEAT, cobs_decode, crc8
+export DeviceClock, devicetime!, hosttime!, timestamp, repeats
 
 mutable struct AVCLANframe
     broadcast::Bool
@@ -15,33 +17,188 @@ end
 
 AVCLANframe() = AVCLANframe(false, 0x0000, 0x0000, 0xf, 0x0, ntuple(x -> 0x0, 32))
 
+# Text frames are printed in hex, with or without the "0x" (compact mode)
+parsehex(T, str) = tryparse(T, chopprefix(str, "0x"); base=16)
+
 function Base.tryparse(::Type{AVCLANframe}, str::String)
     vals = split(str)
+    length(vals) < 5 && return nothing
 
     broadcast = tryparse(Bool, vals[1])
     isnothing(broadcast) && return nothing
 
-    controller_addr = tryparse(UInt16, vals[2])
+    controller_addr = parsehex(UInt16, vals[2])
     isnothing(controller_addr) && return nothing
 
-    peripheral_addr = tryparse(UInt16, vals[3])
+    peripheral_addr = parsehex(UInt16, vals[3])
     isnothing(peripheral_addr) && return nothing
 
-    control = tryparse(UInt8, vals[4])
+    control = parsehex(UInt8, vals[4])
     isnothing(control) && return nothing
 
-    len = tryparse(UInt8, vals[5])
+    len = parsehex(UInt8, vals[5])
     isnothing(len) && return nothing
 
     if (length(vals) - 5) != len || len > 32
         return nothing
     end
-    _data = tryparse.(UInt8, vals[6:end])
+    _data = parsehex.(UInt8, vals[6:end])
     data = ntuple(i -> checkindex(Bool, axes(_data, 1), i) ? _data[i] : 0x0, 32)
 
     return AVCLANframe(broadcast, controller_addr, peripheral_addr, control, len, data)
 end
 
+# Binary capture records, as sent by the Mockingboard in binary mode; see
+# "Binary capture records" in src/avclandrv.c for the format
+const CAPTURE_FRAME = 0x0
+const CAPTURE_STATS = 0x1
+const CAPTURE_REPEAT = 0x2
+
+struct CaptureRecord
+    seq::UInt8
+    type::UInt8
+    flags::UInt8
+    payload::Vector{UInt8}
+end
+
+# Decode a COBS-encoded record (without its 0x00 delimiters)
+function cobs_decode(bytes::AbstractVector{UInt8})
+    out = Vector{UInt8}(undef, 0)
+    i = 1
+    while i <= length(bytes)
+        code = Int(bytes[i])
+        (code == 0 || i + code - 1 > length(bytes)) && return nothing
+        append!(out, @view bytes[i+1:i+code-1])
+        i += code
+        if code < 0xff && i <= length(bytes)
+            push!(out, 0x00)
+        end
+    end
+
+    return out
+end
+
+# CRC-8, polynomial 0x07, initial value 0 (avr-libc `_crc8_ccitt_update`)
+function crc8(bytes::AbstractVector{UInt8})
+    crc = 0x00
+    for b in bytes
+        crc ⊻= b
+        for _ in 1:8
+            crc = (crc & 0x80) != 0 ? (crc << 1) ⊻ 0x07 : crc << 1
+        end
+    end
+
+    return crc
+end
+
+function Base.tryparse(::Type{CaptureRecord}, encoded::AbstractVector{UInt8})
+    bytes = cobs_decode(encoded)
+    (isnothing(bytes) || length(bytes) < 2) && return nothing
+
+    flags = bytes[2]
+    if (flags & 0x80) != 0
+        (length(bytes) < 3 || crc8(@view bytes[1:end-1]) != bytes[end]) && return nothing
+        pop!(bytes)
+    end
+    type = (flags >> 5) & 0x3
+    if type == CAPTURE_FRAME && !(7 <= length(bytes) - 2 <= 7 + 32)
+        return nothing
+    end
+    if type == CAPTURE_REPEAT &&
+       (length(bytes) < 8 || length(bytes) - 2 != (bytes[4] > 1 ? 10 : 6))
+        return nothing
+    end
+
+    return CaptureRecord(bytes[1], type, flags, bytes[3:end])
+end
+
+function AVCLANframe(record::CaptureRecord)
+    p = @view record.payload[5:end] # After the timestamp
+    len = length(p) - 3
+    controller_addr = (UInt16(p[1]) << 4) | (p[2] >> 4)
+    peripheral_addr = (UInt16(p[2] & 0x0f) << 8) | p[3]
+    data = ntuple(i -> i <= len ? p[3+i] : 0x0, 32)
+
+    return AVCLANframe((record.flags & 0x10) != 0, controller_addr, peripheral_addr,
+                       record.flags & 0x0f, len, data)
+end
+
+# Device clock as sent: (count of 50 ms periods, μs into the period)
+function timestamp(p::AbstractVector{UInt8})
+    return (UInt16(p[1]) | UInt16(p[2]) << 8, UInt16(p[3]) | UInt16(p[4]) << 8)
+end
+
+timestamp(record::CaptureRecord) = timestamp(record.payload)
+
+# A CAPTURE_REPEAT record: (seq of the repeated frame, times repeated,
+# timestamps of the first and last repeat)
+function repeats(record::CaptureRecord)
+    p = record.payload
+    first = timestamp(@view p[3:6])
+    last = p[2] > 1 ? timestamp(@view p[7:10]) : first
+    return (p[1], Int(p[2]), first, last)
+end
+
+const TIMESTAMP_PERIOD = 0.05 # Seconds
+const CLOCK_WINDOW = 10.0 # Seconds
+
+# Maps the device's timestamps onto host time. Serial latency only ever delays
+# the host's view of a record, so the mapping goes through the least delayed
+# sample (device, host) of each CLOCK_WINDOW seconds. Its rate, fitted between
+# the least delayed samples of the first and the latest complete window,
+# corrects for the drift of the device's oscillator.
+mutable struct DeviceClock
+    periods::Int64 # Unwrapped count of periods
+    lastperiod::Union{Nothing,UInt16}
+    windowstart::Float64
+    window::Tuple{Float64,Float64} # Least delayed sample of this window
+    first::Tuple{Float64,Float64}  # ... of the first window
+    last::Tuple{Float64,Float64}   # ... of the latest complete window
+    rate::Float64
+end
+
+DeviceClock() = DeviceClock(0, nothing, NaN, (NaN, NaN), (NaN, NaN), (NaN, NaN), 1.0)
+
+# Device time in seconds of a `timestamp`, unwrapping the period count
+function devicetime!(clock::DeviceClock, (period, us)::Tuple{UInt16,UInt16})
+    if !isnothing(clock.lastperiod)
+        # Sent frames are reported a little after later received ones
+        clock.periods += (period - clock.lastperiod) % Int16
+    end
+    clock.lastperiod = period
+
+    return clock.periods * TIMESTAMP_PERIOD + us * 1e-6
+end
+
+# Host time (seconds, as from `time()`) of device time `dev`, for a record
+# read at host time `host`
+function hosttime!(clock::DeviceClock, dev::Float64, host::Float64)
+    delay((d, h)) = h - clock.rate * d
+
+    if isnan(clock.windowstart)
+        clock.windowstart = dev
+        clock.window = clock.first = clock.last = (dev, host)
+    elseif dev - clock.windowstart >= CLOCK_WINDOW
+        if clock.first[1] >= clock.windowstart
+            clock.first = clock.window # The first window is complete
+        end
+        clock.last = clock.window
+        if clock.last[1] - clock.first[1] > 0
+            clock.rate = (clock.last[2] - clock.first[2]) / (clock.last[1] - clock.first[1])
+        end
+        clock.windowstart = dev
+        clock.window = (dev, host)
+    elseif delay((dev, host)) < delay(clock.window)
+        clock.window = (dev, host)
+    end
+
+    if clock.first == clock.last
+        # Still in the first window; follow its least delayed sample so far
+        return clock.window[2] + (dev - clock.window[1])
+    end
+    return clock.last[2] + clock.rate * (dev - clock.last[1])
+end
+
 function tobytes(frame::AVCLANframe)
     data = Vector{UInt8}(undef, 0)
     push!(data, frame.broadcast)
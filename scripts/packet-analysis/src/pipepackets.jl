@@ -3,43 +3,76 @@ include("AVCLANPipe.jl")
 using .AVCLANPipe, PcapTools, Dates, UnixTimes, LibSerialPort
 
 serial_port="/dev/ttyUSB0"
-baud=1200000
+baud=1200000 # RS232_BAUD
+flow_control=false # RS232_FLOW_CONTROL
 
 pcapstream = PcapStreamWriter(stdout; snaplen=64, linktype=162)
 serial = LibSerialPort.open(serial_port, baud)
-set_flow_control(serial) # Disable flow-control (stops it from eating raw byte 0x11)
+# RTS/CTS if the firmware is built with RS232_FLOW_CONTROL; XON/XOFF stays off,
+# as it would eat raw byte 0x11
+if flow_control
+    set_flow_control(serial; rts=SP_RTS_FLOW_CONTROL, cts=SP_CTS_FLOW_CONTROL)
+else
+    set_flow_control(serial; rts=SP_RTS_ON, cts=SP_CTS_IGNORE, xonxoff=SP_XONXOFF_DISABLED)
+end
 
 write(serial, 'X')
-buf = IOBuffer()
 
 function quit(serialio=serial)
     close(serialio)
     exit()
 end
 
+lastseq = nothing
+clock = DeviceClock()
+recent = Vector{Union{Nothing,AVCLANframe}}(nothing, 256) # Frames by seq
+
 while true
     iswritable(stdout) || isopen(stdout) || quit()
     if bytesavailable(serial) > 0
-        t = UnixTime(now())
-        line = readline(serial)
-        # allthebytes = Vector{UInt8}(undef, bytesavailable(serial))
-        # readbytes!(serial, allthebytes)
-        # write(buf, allthebytes)
-        # l = findfirst(==('\n'), buf.data)
-        # if !isnothing(l)
-            # println(stderr, "fucku")
-            # bytes = Vector{UInt8}(undef, l)
-            # seekstart(buf)
-            # readbytes!(buf, bytes)
-            # seekend(buf)
-             bytes = Vector{UInt8}(line)
-            if bytes[1] == 0x10 && bytes[end] == 0x17
-                write(pcapstream, t, bytes[2:end-1])
-            else
-                @error line
+        t, host = UnixTime(now()), time()
+        # Records are COBS-encoded between 0x00 delimiters, so 0x00 can't
+        # appear inside one
+        chunk = readuntil(serial, 0x00)
+        isempty(chunk) && continue # Between two records
+
+        record = tryparse(CaptureRecord, chunk)
+        if isnothing(record)
+            @error String(chunk) # Text output, or a corrupted record
+            continue
+        end
+
+        if !isnothing(lastseq) && record.seq != lastseq + 0x01
+            @warn "Lost $(Int(record.seq - lastseq - 0x01)) records"
+            for k in 0x01:record.seq-lastseq-0x01
+                recent[lastseq+k+1] = nothing # seq wraps around as a UInt8
+            end
+        end
+        global lastseq = record.seq
+        recent[record.seq+1] = nothing
+
+        # Stamp frames with their start bit, timed by the device
+        stamp(dev) = t + Nanosecond(round(Int64, (hosttime!(clock, dev, host) - host) * 1e9))
+
+        if record.type == CAPTURE_FRAME
+            frame = AVCLANframe(record)
+            recent[record.seq+1] = frame
+            write(pcapstream, stamp(devicetime!(clock, timestamp(record))), tobytes(frame))
+        elseif record.type == CAPTURE_REPEAT
+            seq, n, t1, t2 = repeats(record)
+            frame = recent[seq+1]
+            if isnothing(frame)
+                @warn "Lost the frame repeated $n times"
+                continue
+            end
+            # Only the first and last repeat are timed; space the rest evenly
+            d1 = devicetime!(clock, t1)
+            d2 = devicetime!(clock, t2)
+            for i in 0:n-1
+                dev = n > 1 ? d1 + (d2 - d1) * i / (n - 1) : d1
+                write(pcapstream, stamp(dev), tobytes(frame))
             end
-        # end
-        # println(stderr, "wtf")
+        end
     end
     yield()
 end
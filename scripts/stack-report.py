@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Report the worst-case stack depth and the SRAM budget of the firmware.
+
+Frame sizes come from the `.su` files written by `-fstack-usage`; the call
+graph comes from the `call`/`rcall` (and tail `jmp`/`rjmp`) instructions in the
+disassembly of the ELF. The deepest chain is reported from `main` and from each
+interrupt vector; an interrupt can fire at the deepest point of `main`, so the
+budget is static SRAM + main + the deepest interrupt.
+
+Naked ISRs get a 0-byte `.su` entry however much their inline asm pushes, so a
+function's frame is never taken as smaller than the `push` instructions in its
+disassembly (every one counted, so branches can only overstate it).
+
+Things this can't see are listed rather than guessed: indirect calls (`icall`,
+e.g. the `AVCLAN_sent_t` callbacks), functions without a `.su` entry (libgcc,
+avr-libc) and recursion.
+
+Usage: stack-report.py --objdump avr-objdump --ram 2048 firmware.elf objdir...
+"""
+
+import argparse
+import pathlib
+import re
+import subprocess
+import sys
+
+RETURN_ADDRESS = 2  # Bytes pushed by a call on a part with <= 128 KiB flash
+
+SYMBOL = re.compile(r"^[0-9a-f]+ <([^>]+)>:$")
+CALL = re.compile(r"\s(r?call|r?jmp)\s.*<([^>+]+)>$")
+ICALL = re.compile(r"\s(e?icall|e?ijmp)\b")
+PUSH = re.compile(r"\spush\s")
+SECTION = re.compile(r"^\s*\d+\s+(\.\S+)\s+([0-9a-f]+)\s")
+
+
+def read_su(dirs):
+    frames = {}
+    for d in dirs:
+        for su in pathlib.Path(d).rglob("*.su"):
+            for line in su.read_text().splitlines():
+                fields = line.split("\t")
+                if len(fields) < 3:
+                    continue
+                name = fields[0].rsplit(":", 1)[-1]
+                frames[name] = max(frames.get(name, 0), int(fields[1]))
+    return frames
+
+
+def read_calls(objdump, elf):
+    out = subprocess.run([objdump, "-d", elf], capture_output=True, text=True,
+                         check=True).stdout
+    calls, indirect, pushes = {}, set(), {}
+    func = None
+    for line in out.splitlines():
+        m = SYMBOL.match(line)
+        if m:
+            func = m.group(1)
+            calls.setdefault(func, set())
+            pushes.setdefault(func, 0)
+            continue
+        if func is None:
+            continue
+        m = CALL.search(line)
+        if m and m.group(2) != func:
+            calls[func].add(m.group(2))
+        elif ICALL.search(line):
+            indirect.add(func)
+        elif PUSH.search(line):
+            pushes[func] += 1
+    return calls, indirect, pushes
+
+
+def read_static(objdump, elf):
+    out = subprocess.run([objdump, "-h", elf], capture_output=True, text=True,
+                         check=True).stdout
+    size = 0
+    for line in out.splitlines():
+        m = SECTION.match(line)
+        if m and m.group(1) in (".data", ".bss", ".noinit"):
+            size += int(m.group(2), 16)
+    return size
+
+
+class Graph:
+    def __init__(self, frames, calls):
+        self.frames = frames
+        self.calls = calls
+        self.memo = {}
+        self.unknown = set()
+        self.recursive = set()
+
+    # Deepest chain below `func`, including its own frame: (bytes, chain)
+    def depth(self, func, path=()):
+        if func in path:
+            self.recursive.add(func)
+            return 0, [func + " (recursion)"]
+        if func in self.memo:
+            return self.memo[func]
+        if func not in self.frames:
+            self.unknown.add(func)
+        best, chain = 0, []
+        for callee in sorted(self.calls.get(func, ())):
+            d, c = self.depth(callee, path + (func,))
+            if d + RETURN_ADDRESS > best:
+                best, chain = d + RETURN_ADDRESS, c
+        result = (self.frames.get(func, 0) + best, [func] + chain)
+        self.memo[func] = result
+        return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--objdump", default="avr-objdump")
+    parser.add_argument("--ram", type=int, required=True, help="SRAM in bytes")
+    parser.add_argument("elf")
+    parser.add_argument("objdirs", nargs="+", help="Where to look for .su files")
+    args = parser.parse_args()
+
+    frames = read_su(args.objdirs)
+    if not frames:
+        sys.exit("No .su files found; build with -fstack-usage")
+    calls, indirect, pushes = read_calls(args.objdump, args.elf)
+    for func in frames:
+        frames[func] = max(frames[func], pushes.get(func, 0))
+    graph = Graph(frames, calls)
+
+    main_depth, main_chain = graph.depth("main")
+    print(f"main: {main_depth} bytes")
+    print("  " + " -> ".join(main_chain))
+
+    isr_depth = 0
+    for vector in sorted(f for f in calls if f.startswith("__vector_")):
+        d, chain = graph.depth(vector)
+        d += RETURN_ADDRESS
+        isr_depth = max(isr_depth, d)
+        print(f"{vector}: {d} bytes")
+        print("  " + " -> ".join(chain))
+
+    static = read_static(args.objdump, args.elf)
+    used = static + main_depth + isr_depth
+    print()
+    print(f"Static SRAM (.data + .bss): {static:5} bytes")
+    print(f"Stack, main + deepest ISR:  {main_depth + isr_depth:5} bytes")
+    print(f"Headroom:                   {args.ram - used:5} of {args.ram} bytes")
+
+    reachable = set(graph.memo)
+    notes = [
+        ("Indirect calls (not followed)", indirect & reachable),
+        ("No stack usage information", graph.unknown),
+        ("Recursive", graph.recursive),
+    ]
+    for title, funcs in notes:
+        if funcs:
+            print(f"{title}: {', '.join(sorted(funcs))}")
+
+    return 1 if used > args.ram else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
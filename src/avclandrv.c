@@ -92,9 +92,11 @@
 #include <avr/interrupt.h>
 #include <avr/io.h>
 #include <avr/sfr_defs.h>
+#include <avr/xmega.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <util/crc16.h>
 
 #define VAR_DECLS
 #include "avclandrv.h"
@@ -138,6 +140,9 @@
 uint8_t printAllFrames;
 uint8_t verbose;
 uint8_t printBinary;
+uint8_t printCompact; // Text frames without the "0x"s
+
+AVCLAN_stats_t stats;
 
 AVCLAN_CD_Status_t cd_status;
 
@@ -156,19 +161,154 @@ uint16_t period = 0;
 
 uint16_t pulsewidth;
 
-// answers
-uint8_t lancheck_resp[] = {0x00, 0x01, 0x00, 0xFF};
-const uint8_t list_functions_resp[] = {0x00, dev_COMM_CTRL, dev_COMM_v1,
-                                       List_Functions_Resp, dev_CD_CHANGER};
-uint8_t ping_resp[] = {0x00, dev_COMM_CTRL, dev_COMM_v1, Ping_Resp, 0xFF, 0x00};
-uint8_t function_change_resp[] = {0x00, dev_CD_CHANGER, dev_COMM_v1, 0xFF,
-                                  0x01};
-uint8_t cdstatus_resp[] = {
-    dev_CD_CHANGER, dev_STATUS, Report, 0x01, cd_SEEKING_TRACK, 0x01, 0x00,
-    0xFF,           0x7F,       0x00,   0xc0};
+// Receive state machine; each state names the field the ISR is reading. Fields
+// are at most 8 bits wide (the width of READING_BYTE), so 12-bit addresses are
+// read as a 4-bit high nibble followed by the low byte.
+typedef enum {
+  RX_IDLE = 0, // Waiting for a start bit
+  RX_BROADCAST,
+  RX_CONTROLLER_HI,
+  RX_CONTROLLER_LO,
+  RX_CONTROLLER_PARITY,
+  RX_PERIPHERAL_HI,
+  RX_PERIPHERAL_LO,
+  RX_PERIPHERAL_PARITY,
+  RX_PERIPHERAL_ACK,
+  RX_CONTROL,
+  RX_CONTROL_PARITY,
+  RX_CONTROL_ACK,
+  RX_LENGTH,
+  RX_LENGTH_PARITY,
+  RX_LENGTH_ACK,
+  RX_DATA,
+  RX_DATA_PARITY,
+  RX_DATA_ACK,
+  // Frames rejected by the acceptance filter, or without a free slot; only the
+  // length is decoded
+  RX_SKIP_ADDRESS, // Broadcast, addresses and their parity bits
+  RX_SKIP_CONTROL, // ACK, control, parity, ACK
+  RX_SKIP_LENGTH,
+  RX_SKIP_DATA, // Length parity and ACK, then data bytes with parity and ACK
+  // Only used to report errors
+  RX_ERR_STARTBIT,
+  RX_ERR_TRUNCATED,
+} AVCLAN_rxstate_t;
+
+// Start bit limits (TCB ticks). Any pulse whose high byte reaches
+// RX_STARTBIT_HI is treated as a start bit, even in the middle of a frame.
+#define RX_STARTBIT_MIN (uint16_t)(AVCLAN_STARTBIT_LOGIC_0 * 0.8)
+#define RX_STARTBIT_MAX (uint16_t)(AVCLAN_STARTBIT_LOGIC_0 * 1.2)
+#define RX_STARTBIT_HI  (uint8_t)(RX_STARTBIT_MIN >> 8)
+_Static_assert(RX_STARTBIT_HI > ((uint16_t)AVCLAN_BIT_LENGTH_MAX >> 8),
+               "TCB clock too slow to tell start bits from data bits");
+
+// Received frames are decoded straight into a fixed pool of slots, filled in
+// order by the ISR and released in order by `AVCLAN_readframe`
+#ifndef AVCLAN_RX_SLOTS
+  #define AVCLAN_RX_SLOTS 4
+#endif
+#if (AVCLAN_RX_SLOTS & (AVCLAN_RX_SLOTS - 1)) != 0 || AVCLAN_RX_SLOTS > 128
+  #error "AVCLAN_RX_SLOTS must be a power of 2, at most 128"
+#endif
+
+AVCLAN_frame_t rxQueue[AVCLAN_RX_SLOTS];
+uint32_t rxTime[AVCLAN_RX_SLOTS]; // When each frame's start bit began
+volatile uint8_t rxWrite;
+volatile uint8_t rxRead;
+uint16_t rxOverflowReported;
+
+volatile AVCLAN_rxstate_t rxState;
+AVCLAN_frame_t *rxFrame;
+uint8_t rxDataIdx;
+uint8_t rxShouldACK;
+uint8_t rxReplay; // Decoding pulses from `AVCLAN_rx_replay`; never ACK
+uint16_t rxSkipBits;
+
+// Acceptance filter, checked as soon as both addresses have been received. A
+// frame is accepted if, for any entry, all the address bits selected by the
+// masks match. Rejected frames are skipped without being stored or printed.
+#define RXFILTER_LEN 4
+
+AVCLAN_filter_t rxFilter[RXFILTER_LEN];
+uint8_t rxFilterCount;
+uint8_t rxFilterEnabled;
+
+#ifdef AVCLAN_RX_DEFERRED
+  #ifndef PULSE_FIFO_LEN
+    #define PULSE_FIFO_LEN 64 // Must be a power of 2, at most 128
+  #endif
+
+// Raw pulse capture; filled by the TCB0 ISR, decoded by `AVCLAN_rx_process`
+typedef struct AVCLAN_pulse_struct {
+  uint16_t width; // TCB ticks
+  uint16_t time;  // RTC ticks (~30.5 us)
+} AVCLAN_pulse_t;
+
+AVCLAN_pulse_t pulseFifo[PULSE_FIFO_LEN];
+volatile uint8_t pulseWrite;
+volatile uint8_t pulseRead;
+uint16_t pulseLastTime;
+
+// Pulses were dropped just before entry `pulseGapAt` because the FIFO was full
+volatile uint8_t pulseGap;
+uint8_t pulseGapAt;
+
+// Timestamps of the start bits in the FIFO, taken by the ISR as they end, and
+// the FIFO entries they belong to. A frame is at least 45 pulses long; noise of
+// start bit width can still fill the stamps up, and the ISR then drops them, so
+// stamps are matched to start bits by entry rather than by order.
+  #if PULSE_FIFO_LEN / 45 + 2 <= 4
+    #define START_STAMPS 4
+  #else
+    #define START_STAMPS 8
+  #endif
+typedef struct AVCLAN_stamp_struct {
+  uint32_t time;
+  uint8_t pulse; // `pulseWrite` of the start bit
+} AVCLAN_stamp_t;
+
+AVCLAN_stamp_t startStamps[START_STAMPS];
+volatile uint8_t startStampWrite;
+uint8_t startStampRead;
+uint8_t pulseCurrent; // FIFO entry being decoded
+
+// Smallest distance (in TCB ticks) between any bit and the read threshold
+uint16_t rxMargin[AVCLAN_RX_SLOTS];
+#endif
+
+// Logical `0` pulses at least this long (in TCB ticks) are read as bit `0`s;
+// see `AVCLAN_calib_update`
+uint16_t readbitThreshold = (uint16_t)AVCLAN_READBIT_THRESHOLD;
+
+// Most recent receive error; reported by `AVCLAN_readframe`
+volatile AVCLAN_rxstate_t rxErrState;
+uint16_t rxErrValue;
+uint8_t rxErrParity;
+
+static inline uint8_t rxMask(uint8_t pos) {
+  return pos & (AVCLAN_RX_SLOTS - 1);
+}
+
+static inline void AVCLAN_rx_next(AVCLAN_rxstate_t state, uint8_t nbits) {
+  rxState = state;
+  READING_BYTE = 0;
+  READING_NBITS = nbits;
+}
+
+static inline void AVCLAN_rx_reset() {
+  rxState = RX_IDLE;
+  READING_BYTE = 0;
+  READING_PARITY = 0;
+  READING_NBITS = 1;
+}
 
 uint8_t AVCLAN_handleframe(const AVCLAN_frame_t *frame);
 void AVCLAN_updateCDStatus();
+static inline void AVCLAN_rx_resume();
+static void AVCLAN_rx_resync(uint16_t arb, uint8_t nbits);
+static void AVCLAN_tpl_init();
+static void AVCLAN_pool_init();
+static void AVCLAN_capture_idle();
 
 void AVCLAN_init() {
   // Pull-ups are disabled by default
@@ -187,20 +327,41 @@ void AVCLAN_init() {
   EVSYS.ASYNCCH0 = EVSYS_ASYNCCH0_AC2_OUT_gc;
   EVSYS.ASYNCUSER0 = EVSYS_ASYNCUSER0_ASYNCCH0_gc; // USER0 is TCB0
 
-  // TCB0 for read bit timing
+  // TCB0 for read bit timing; frames are decoded by its capture ISR
+  AVCLAN_pool_init();
+  AVCLAN_rx_reset();
+  AVCLAN_calib_reset();
+  calibEnabled = 1;
+
+  // Default acceptance filter: everything the CD changer emulation responds to
+  AVCLAN_rx_addfilter(0x000, 0x000, DEVICE_ADDR, 0xFFF);
+  AVCLAN_rx_addfilter(0x000, 0x000, 0x1FF, 0x1FF); // 0x1FF and 0xFFF
+  rxFilterEnabled = 0;
+
   TCB0.CTRLB = TCB_CNTMODE;
   TCB0.INTCTRL = TCB_CAPT_bm;
   TCB0.EVCTRL = TCB_CAPTEI_bm;
   TCB0.CTRLA = TCB_CLKSEL | TCB_ENABLE_bm;
 
+#ifdef AVCLAN_TX_TCD
+  // TCD0 sends frames; WOC follows WOB, the complement of WOA
+  TCD0.CTRLB = TCD_WGMODE_ONERAMP_gc;
+  TCD0.CTRLC = TCD_CMPCSEL_PWMB_gc;
+#endif
+
   // TCB1 for send bit timing
   TCB1.CTRLB = TCB_CNTMODE_INT_gc;
   TCB1.CCMP = 0xFFFF;
   TCB1.CTRLA = TCB_CLKSEL | TCB_ENABLE_bm;
 
+  // TCA0 for timestamps; the OVF interrupt counts TIMESTAMP_PERIOD_US periods
+  TCA0.SINGLE.PER = TIMESTAMP_TICKS - 1;
+  TCA0.SINGLE.INTCTRL = TCA_SINGLE_OVF_bm;
+  TCA0.SINGLE.CTRLA = TCA_SINGLE_CLKSEL_DIV16_gc | TCA_SINGLE_ENABLE_bm;
+
   // Setup RTC as 1 sec periodic timer
   loop_until_bit_is_clear(RTC_STATUS, RTC_CTRLABUSY_bp);
-  RTC.CTRLA = RTC_PRESCALER_DIV1_gc;
+  RTC.CTRLA = RTC_PRESCALER_DIV1_gc | RTC_RTCEN_bm; // CNT used as a timestamp
   RTC.CLKSEL = RTC_CLKSEL_INT32K_gc;
   RTC.PITINTCTRL = RTC_PI_bm;
   loop_until_bit_is_clear(RTC_PITSTATUS, RTC_CTRLBUSY_bp);
@@ -234,6 +395,8 @@ void AVCLAN_init() {
   cd_Time_Sec = &cd_status.secs;
 
   CD_Mode = stStop;
+
+  AVCLAN_tpl_init();
 }
 
 /* Increment packed 2-digit BCD number.
@@ -263,6 +426,54 @@ ISR(RTC_PIT_vect) {
   RTC.PITINTFLAGS |= RTC_PI_bm;
 }
 
+/* Timestamps
+
+   A timestamp is the number of TIMESTAMP_PERIOD_US periods counted by the
+   TCA0 OVF interrupt in the high word and TCA0.CNT (TIMESTAMP_TICK ns ticks)
+   in the low word. It wraps after ~55 minutes; the host unwraps it. */
+
+_Static_assert(F_CPU % (16 * (1000000 / TIMESTAMP_PERIOD_US)) == 0,
+               "TIMESTAMP_PERIOD_US is not a whole number of TCA0 ticks");
+_Static_assert(TIMESTAMP_TICKS <= 0x10000, "TIMESTAMP_PERIOD_US is too long");
+
+volatile uint16_t timestampPeriod;
+uint32_t txTime; // When the frame being sent started
+
+ISR(TCA0_OVF_vect) {
+  timestampPeriod++;
+  TCA0.SINGLE.INTFLAGS = TCA_SINGLE_OVF_bm;
+}
+
+// With interrupts disabled, an overflow not yet counted is still pending
+static inline uint32_t AVCLAN_timestamp_isr() {
+  uint16_t ticks = TCA0.SINGLE.CNT;
+  uint16_t period = timestampPeriod;
+  if (bit_is_set(TCA0_SINGLE_INTFLAGS, TCA_SINGLE_OVF_bp) &&
+      ticks < TIMESTAMP_TICKS / 2)
+    period++;
+  return ((uint32_t)period << 16) | ticks;
+}
+
+uint32_t AVCLAN_timestamp() {
+  uint8_t sreg = SREG;
+  cli();
+  uint32_t time = AVCLAN_timestamp_isr();
+  SREG = sreg;
+  return time;
+}
+
+// `time` moved back by `width` TCB ticks
+static uint32_t AVCLAN_timestamp_before(uint32_t time, uint16_t width) {
+  uint16_t ticks = time;
+  uint16_t period = time >> 16;
+  width /= (uint8_t)(TIMESTAMP_TICK / TCB_TICK);
+  if (ticks < width) {
+    period--;
+    ticks += TIMESTAMP_TICKS;
+  }
+  return ((uint32_t)period << 16) | (uint16_t)(ticks - width);
+}
+
 // Mute device TX on AVCLAN bus
 void AVCLAN_muteDevice(uint8_t mute) {
   if (mute) {
@@ -302,21 +513,6 @@ void set_AVC_logic_for(uint8_t val, uint16_t period) {
   return;
 }
 
-void AVCLAN_sendbit_start() {
-  set_AVC_logic_for(0, AVCLAN_STARTBIT_LOGIC_0);
-  set_AVC_logic_for(1, AVCLAN_STARTBIT_LOGIC_1);
-}
-
-static inline void AVCLAN_sendbit_1() {
-  set_AVC_logic_for(0, AVCLAN_BIT1_LOGIC_0);
-  set_AVC_logic_for(1, AVCLAN_BIT1_LOGIC_1);
-}
-
-static inline void AVCLAN_sendbit_0() {
-  set_AVC_logic_for(0, AVCLAN_BIT0_LOGIC_0);
-  set_AVC_logic_for(1, AVCLAN_BIT0_LOGIC_1);
-}
-
 void AVCLAN_sendbit_ACK() {
   TCB1.CNT = 0;
 
@@ -332,6 +528,393 @@ void AVCLAN_sendbit_ACK() {
   set_AVC_logic_for(1, AVCLAN_BIT0_LOGIC_1);
 }
 
+/* Transmit bitstream
+
+   Frames are encoded once by `AVCLAN_encodeframe` into a packed bit vector
+   (MSB first, starting after the start bit), with the parity bits already in
+   place and the acknowledge bits marked in a parallel mask. Sending only has
+   to walk the vector, so no parity or field bookkeeping happens between bit
+   edges, and an encoded frame can be sent again on a retry as is. */
+
+// Broadcast bit, addresses, control and length, each with parity (and ACK),
+// followed by `len` data bytes with parity and ACK
+#define TX_BITS(len)  (1 + 13 + 13 + 1 + 5 + 1 + 9 + 1 + (len) * 10)
+#define TX_BYTES(len) ((TX_BITS(len) + 7) / 8)
+
+typedef struct AVCLAN_txstream_struct {
+  uint16_t nbits;
+  uint8_t *bits; // An acknowledge bit is sent as a bit `1`
+  uint8_t *acks; // Set for acknowledge bits
+} AVCLAN_txstream_t;
+
+// Initialiser for a stream with room for `len` data bytes
+#define TX_STREAM(len)                                                         \
+  {.bits = (uint8_t[TX_BYTES(len)]){0}, .acks = (uint8_t[TX_BYTES(len)]){0}}
+
+// The broadcast bit and controller address decide arbitration: a node that
+// sends a bit `1` while another sends a `0` stops sending and becomes a receiver
+#define TX_ARB_BITS 13
+
+typedef enum {
+  TX_IDLE = 0,
+  TX_BUSY,
+  TX_DONE,
+  TX_NAK,
+  TX_LOST,    // Lost arbitration at `txLostBit`
+  TX_REFUSED, // Muted, or too long to send
+} AVCLAN_txstate_t;
+
+AVCLAN_txstream_t txStream = TX_STREAM(MAXMSGLEN);
+const AVCLAN_frame_t *txFrame;   // Being sent, or waiting to be reported
+AVCLAN_sent_t txDone;
+volatile AVCLAN_txstate_t txState;
+volatile uint8_t txAcks; // Acknowledge bits received this frame
+uint16_t txArb;          // Broadcast bit and controller address being sent
+uint8_t txLostBit;
+
+// Append the low `len` bits of `value`, MSB first
+static void AVCLAN_encodebits(AVCLAN_txstream_t *s, uint16_t value,
+                              uint8_t len) {
+  value <<= (uint8_t)(16 - len);
+  for (; len > 0; len--) {
+    if (value & 0x8000)
+      s->bits[s->nbits >> 3] |= (uint8_t)(0x80 >> (s->nbits & 0x7));
+    value <<= 1;
+    s->nbits++;
+  }
+}
+
+// Append a field and its even parity bit, followed by an acknowledge bit if
+// `ack`
+static void AVCLAN_encodefield(AVCLAN_txstream_t *s, uint16_t value,
+                               uint8_t len, uint8_t ack) {
+  value &= (uint16_t)((1 << len) - 1);
+  AVCLAN_encodebits(s, value, len);
+  AVCLAN_encodebits(s, __builtin_parity(value), 1);
+  if (ack) {
+    s->acks[s->nbits >> 3] |= (uint8_t)(0x80 >> (s->nbits & 0x7));
+    AVCLAN_encodebits(s, 1, 1);
+  }
+}
+
+// Encode `frame` for sending; `s` must have room for `frame->length` bytes.
+// Returns 1 if the frame is too long.
+static uint8_t AVCLAN_encodeframe(AVCLAN_txstream_t *s,
+                                  const AVCLAN_frame_t *frame) {
+  if (frame->length > MAXMSGLEN)
+    return 1;
+
+  // No acknowledge bits are sent for broadcast frames
+  uint8_t ack = (frame->broadcast != BROADCAST);
+
+  s->nbits = 0;
+  memset(s->bits, 0, TX_BYTES(frame->length));
+  memset(s->acks, 0, TX_BYTES(frame->length));
+  AVCLAN_encodebits(s, frame->broadcast, 1);
+  AVCLAN_encodefield(s, frame->controller_addr, 12, 0);
+  AVCLAN_encodefield(s, frame->peripheral_addr, 12, ack);
+  AVCLAN_encodefield(s, frame->control, 4, ack);
+  AVCLAN_encodefield(s, frame->length, 8, ack);
+  // Based on the µPD6708 datasheet, ACK bit for broadcast doesn't seem
+  // necessary (i.e. This deviates from the previous broadcast specific
+  // function that sent an extra `1` bit after each byte/parity)
+  for (uint8_t i = 0; i < frame->length; i++)
+    AVCLAN_encodefield(s, frame->data[i], 8, ack);
+
+  return 0;
+}
+
+/* Response templates
+
+   The responses are encoded once, at init, into their own bitstreams. Only
+   the fields that change between replies (the response opcode, the echoed
+   ping count, the CD status) are patched, by flipping the bits that differ
+   and the parity bit of each byte whose parity changed, so a reply is ready
+   to send as soon as the request has been read. A template must not be
+   patched while it is being sent. */
+
+typedef struct AVCLAN_txtemplate_struct {
+  AVCLAN_frame_t frame;
+  AVCLAN_txstream_t stream;
+  uint8_t dataPos; // Position of the first data bit in `stream`
+} AVCLAN_txtemplate_t;
+
+// Template of a response from the CD changer with the data bytes `...`
+#define TX_TEMPLATE(type, peripheral, ...)                                     \
+  {.frame = {.broadcast = type,                                                \
+             .controller_addr = DEVICE_ADDR,                                   \
+             .peripheral_addr = peripheral,                                    \
+             .control = 0xF,                                                   \
+             .length = sizeof((uint8_t[]){__VA_ARGS__}),                       \
+             .data = {__VA_ARGS__}},                                           \
+   .stream = TX_STREAM(sizeof((uint8_t[]){__VA_ARGS__}))}
+
+// answers
+AVCLAN_txtemplate_t lancheck_tpl =
+    TX_TEMPLATE(UNICAST, HU_ADDR, 0x00, 0x01, 0x00, 0xFF);
+AVCLAN_txtemplate_t list_functions_tpl =
+    TX_TEMPLATE(UNICAST, HU_ADDR, 0x00, dev_COMM_CTRL, dev_COMM_v1,
+                List_Functions_Resp, dev_CD_CHANGER);
+AVCLAN_txtemplate_t ping_tpl = TX_TEMPLATE(
+    UNICAST, HU_ADDR, 0x00, dev_COMM_CTRL, dev_COMM_v1, Ping_Resp, 0xFF, 0x00);
+AVCLAN_txtemplate_t function_change_tpl = TX_TEMPLATE(
+    UNICAST, HU_ADDR, 0x00, dev_CD_CHANGER, dev_COMM_v1, 0xFF, 0x01);
+AVCLAN_txtemplate_t cdstatus_tpl =
+    TX_TEMPLATE(BROADCAST, 0x1FF, dev_CD_CHANGER, dev_STATUS, Report, 0x01,
+                cd_SEEKING_TRACK, 0x01, 0x00, 0xFF, 0x7F, 0x00, 0xc0);
+
+static void AVCLAN_tpl_encode(AVCLAN_txtemplate_t *t) {
+  uint8_t ack = (t->frame.broadcast != BROADCAST);
+
+  AVCLAN_encodeframe(&t->stream, &t->frame);
+  t->dataPos = t->stream.nbits - t->frame.length * (9 + ack);
+}
+
+static void AVCLAN_tpl_init() {
+  AVCLAN_tpl_encode(&lancheck_tpl);
+  AVCLAN_tpl_encode(&list_functions_tpl);
+  AVCLAN_tpl_encode(&ping_tpl);
+  AVCLAN_tpl_encode(&function_change_tpl);
+  AVCLAN_tpl_encode(&cdstatus_tpl);
+}
+
+// Flip the bits set in the low `len` bits of `diff`, starting at `pos`
+static void AVCLAN_flipbits(AVCLAN_txstream_t *s, uint16_t pos, uint8_t diff,
+                            uint8_t len) {
+  uint8_t mask = 1 << (len - 1);
+  for (; mask; mask >>= 1, pos++) {
+    if (diff & mask)
+      s->bits[pos >> 3] ^= (uint8_t)(0x80 >> (pos & 0x7));
+  }
+}
+
+// Set data byte `i` of a template
+static void AVCLAN_tpl_set(AVCLAN_txtemplate_t *t, uint8_t i, uint8_t value) {
+  uint8_t diff = t->frame.data[i] ^ value;
+  if (!diff)
+    return;
+
+  uint8_t ack = (t->frame.broadcast != BROADCAST);
+  uint16_t pos = t->dataPos + i * (9 + ack);
+
+  t->frame.data[i] = value;
+  AVCLAN_flipbits(&t->stream, pos, diff, 8);
+  AVCLAN_flipbits(&t->stream, pos + 8, __builtin_parity(diff), 1);
+}
+
+// Set `len` data bytes of a template, starting at byte `i`
+static void AVCLAN_tpl_write(AVCLAN_txtemplate_t *t, uint8_t i,
+                             const void *src, uint8_t len) {
+  const uint8_t *p = src;
+  for (; len > 0; len--)
+    AVCLAN_tpl_set(t, i++, *p++);
+}
+
+#ifdef AVCLAN_TX_TCD
+  #define TX_STOPEvent
+  #define TX_STARTEvent
+// The capture of the lost bit has already been read by the engine
+  #define TX_LOST_DECODED 1
+#else
+  #define TX_STOPEvent  STOPEvent
+  #define TX_STARTEvent STARTEvent
+// The winner is still driving the lost bit; TCB0 will capture it
+  #define TX_LOST_DECODED 0
+#endif
+
+// End of a frame, from the TCD0 ISR or the bit-bang loop; back to read mode
+static void AVCLAN_tx_end(AVCLAN_txstate_t state) {
+  if (state == TX_LOST) {
+    // Receive the winning frame, which matches ours up to `txLostBit`, where
+    // it has a `0`
+    TCB0.INTFLAGS = TCB_CAPT_bm; // Discard the capture of our own last bit
+    AVCLAN_rx_resync(txArb & ~(0x1000 >> txLostBit),
+                     txLostBit + TX_LOST_DECODED);
+    sbi(TCB0.INTCTRL, TCB_CAPT_bp);
+    stats.tx_arb_lost++;
+  } else {
+    AVCLAN_rx_resume();
+  }
+  TX_STARTEvent;
+  txState = state;
+}
+
+#ifdef AVCLAN_TX_TCD
+/* TCD0 transmit engine
+
+   TCD0 runs in one-ramp mode with one period per bit. WOA (PA4) is set at the
+   start of the period and cleared after the logical `0` part of the bit; WOC
+   (PC0) follows WOB, which is programmed as the complement of WOA. The compare
+   registers are double-buffered, so one bit is on the bus while the next waits
+   in the buffer, and the OVF interrupt at the start of each bit loads the bit
+   after that straight from the encoded frame. Bit timing no longer depends on
+   interrupt latency, so the RTC and USART interrupts stay enabled while
+   sending.
+
+   An acknowledge bit is sent as a bit `1` and checked at the end of the bit
+   with the TCB0 capture, which keeps measuring the bus while RX is paused; a
+   NAK stops the engine. */
+
+  #if TCB_CLKSEL == TCB_CLKSEL_CLKDIV1_gc
+    #define TCD_SYNCPRES TCD_SYNCPRES_DIV1_gc
+  #elif TCB_CLKSEL == TCB_CLKSEL_CLKDIV2_gc
+    #define TCD_SYNCPRES TCD_SYNCPRES_DIV2_gc
+  #endif
+
+  #define TX_SYM_0     0
+  #define TX_SYM_1     1
+  #define TX_SYM_START 2
+  #define TX_SYM_END   3    // Bus idle; stops the engine
+  #define TX_SYM_ACK   0x80 // Check for an acknowledge at the end of the bit
+  #define TX_SYM_ARB   0x40 // Check that no other node sent a `0`
+
+typedef struct {
+  uint16_t set;    // CMPASET
+  uint16_t clr;    // CMPACLR and CMPBSET
+  uint16_t period; // CMPBCLR
+} AVCLAN_txbit_t;
+
+static const AVCLAN_txbit_t txBitTiming[] = {
+    [TX_SYM_0] = {0, AVCLAN_BIT0_LOGIC_0,
+                  AVCLAN_BIT0_LOGIC_0 + AVCLAN_BIT0_LOGIC_1},
+    [TX_SYM_1] = {0, AVCLAN_BIT1_LOGIC_0,
+                  AVCLAN_BIT1_LOGIC_0 + AVCLAN_BIT1_LOGIC_1},
+    [TX_SYM_START] = {0, AVCLAN_STARTBIT_LOGIC_0,
+                      AVCLAN_STARTBIT_LOGIC_0 + AVCLAN_STARTBIT_LOGIC_1},
+    [TX_SYM_END] = {0xFFF, 0, AVCLAN_BIT_LENGTH_MAX}, // WOA is never set
+};
+_Static_assert((uint16_t)(AVCLAN_STARTBIT_LOGIC_0 + AVCLAN_STARTBIT_LOGIC_1) <
+                   0xFFF,
+               "Start bit is too long for the 12-bit TCD0 counter");
+
+const AVCLAN_txstream_t *txSending;
+uint16_t txBitsLeft;
+uint8_t txArbLeft; // Arbitration bits not yet queued
+uint8_t txArbSent; // Arbitration bits that have finished on the bus
+uint8_t txByte; // Position of the next bit in `txSending`
+uint8_t txMask;
+uint8_t txCurrent; // On the bus
+uint8_t txNext;    // In the TCD0 compare buffers
+
+static inline void AVCLAN_tx_load(uint8_t sym) {
+  const AVCLAN_txbit_t *t = &txBitTiming[sym & ~(TX_SYM_ACK | TX_SYM_ARB)];
+  TCD0.CMPASET = t->set;
+  TCD0.CMPACLR = t->clr;
+  TCD0.CMPBSET = t->clr;
+  TCD0.CMPBCLR = t->period;
+}
+
+// Next bit of the frame being sent
+static inline uint8_t AVCLAN_tx_pop() {
+  if (txBitsLeft == 0)
+    return TX_SYM_END;
+  txBitsLeft--;
+
+  uint8_t sym = (txSending->bits[txByte] & txMask) ? TX_SYM_1 : TX_SYM_0;
+  if (txSending->acks[txByte] & txMask)
+    sym |= TX_SYM_ACK;
+  if (txArbLeft) {
+    txArbLeft--;
+    if (sym == TX_SYM_1)
+      sym |= TX_SYM_ARB;
+  }
+  txMask >>= 1;
+  if (txMask == 0) {
+    txMask = 0x80;
+    txByte++;
+  }
+  return sym;
+}
+
+static void AVCLAN_tx_stop() {
+  TCD0.INTCTRL = 0;
+  TCD0.CTRLA &= ~TCD_ENABLE_bm;
+  loop_until_bit_is_set(TCD0_STATUS, TCD_ENRDY_bp);
+  _PROTECTED_WRITE(TCD0.FAULTCTRL, 0); // Hand the pins back to the PORT
+}
+
+// Start the engine on the start bit and the first bit of `s`; the frame is
+// finished by the OVF interrupt
+static void AVCLAN_tx_run(const AVCLAN_txstream_t *s) {
+  txTime = AVCLAN_timestamp();
+  txSending = s;
+  txBitsLeft = s->nbits;
+  txByte = 0;
+  txMask = 0x80;
+  txArbLeft = TX_ARB_BITS;
+  txArbSent = 0;
+  txAcks = 0;
+  txState = TX_BUSY;
+
+  txCurrent = TX_SYM_START;
+  AVCLAN_tx_load(txCurrent);
+
+  // Outputs idle (WOA low, WOC high) until the counter starts
+  loop_until_bit_is_set(TCD0_STATUS, TCD_ENRDY_bp);
+  _PROTECTED_WRITE(TCD0.FAULTCTRL, TCD_CMPAEN_bm | TCD_CMPCEN_bm | TCD_CMPC_bm);
+  TCD0.CTRLA = TCD_CLKSEL_SYSCLK_gc | TCD_SYNCPRES | TCD_ENABLE_bm;
+
+  txNext = AVCLAN_tx_pop();
+  loop_until_bit_is_set(TCD0_STATUS, TCD_CMDRDY_bp);
+  AVCLAN_tx_load(txNext);
+  TCD0.CTRLE = TCD_SYNCEOC_bm;
+
+  TCD0.INTFLAGS = TCD_OVF_bm;
+  TCD0.INTCTRL = TCD_OVF_bm;
+}
+
+// Start of a bit period; `txNext` has just moved onto the bus
+ISR(TCD0_OVF_vect) {
+  TCD0.INTFLAGS = TCD_OVF_bm;
+
+  if (txCurrent & TX_SYM_ACK) {
+    // The peripheral extends an ACK to the length of a bit `0`
+    if (bit_is_set(TCB0_INTFLAGS, TCB_CAPT_bp) &&
+        TCB0.CCMP >= readbitThreshold) {
+      txAcks++;
+    } else {
+      // The next bit has already started; stopping now cuts it short
+      AVCLAN_tx_stop();
+      AVCLAN_tx_end(TX_NAK);
+      return;
+    }
+  }
+  if (txArbSent < TX_ARB_BITS && txCurrent != TX_SYM_START) {
+    // Another node's bit `0` shows up as a longer pulse than our bit `1`
+    if ((txCurrent & TX_SYM_ARB) && bit_is_set(TCB0_INTFLAGS, TCB_CAPT_bp) &&
+        TCB0.CCMP >= readbitThreshold) {
+      AVCLAN_tx_stop(); // The next bit has only just started
+      txLostBit = txArbSent;
+      AVCLAN_tx_end(TX_LOST);
+      return;
+    }
+    txArbSent++;
+  }
+
+  txCurrent = txNext;
+  if (txCurrent == TX_SYM_END) {
+    AVCLAN_tx_stop();
+    AVCLAN_tx_end(TX_DONE);
+    return;
+  }
+  if (txCurrent & (TX_SYM_ACK | TX_SYM_ARB))
+    TCB0.INTFLAGS = TCB_CAPT_bm; // Only look at the capture from this bit
+
+  txNext = AVCLAN_tx_pop();
+  AVCLAN_tx_load(txNext);
+  TCD0.CTRLE = TCD_SYNCEOC_bm;
+}
+#else
+typedef struct {
+  uint16_t logic_0;
+  uint16_t period;
+} AVCLAN_txbit_t;
+
+static const AVCLAN_txbit_t txBitTiming[] = {
+    {AVCLAN_BIT0_LOGIC_0, AVCLAN_BIT0_LOGIC_0 + AVCLAN_BIT0_LOGIC_1},
+    {AVCLAN_BIT1_LOGIC_0, AVCLAN_BIT1_LOGIC_0 + AVCLAN_BIT1_LOGIC_1},
+};
+
 // Returns true if an ACK bit was sent by the peripheral
 uint8_t AVCLAN_readbit_ACK() {
   TCB1.CNT = 0;
@@ -350,321 +933,1045 @@ uint8_t AVCLAN_readbit_ACK() {
   return 1;
 }
 
-void AVCLAN_sendbit_parity(uint8_t parity) {
-  if (parity) {
-    AVCLAN_sendbit_1();
-  } else {
-    AVCLAN_sendbit_0();
-  }
-}
+/* Send the start bit and `s`
 
-#define AVCLAN_sendbits(bits, len)                                             \
-  _Generic((bits),                                                             \
-      const uint16_t *: AVCLAN_sendbitsl,                                      \
-      uint16_t *: AVCLAN_sendbitsl,                                            \
-      const uint8_t *: AVCLAN_sendbitsi,                                       \
-      uint8_t *: AVCLAN_sendbitsi)(bits, len)
+   TCB1 is only restarted on the falling edge of each bit, and the timing of
+   the next bit is looked up while the current one finishes, so the work
+   between bits doesn't stretch them. While arbitrating, the bus is read back
+   after releasing it for each bit `1`; another node's bit `0` is still
+   driving it at the read threshold. */
+static AVCLAN_txstate_t AVCLAN_tx_stream(const AVCLAN_txstream_t *s) {
+  const uint8_t *bits = s->bits;
+  const uint8_t *acks = s->acks;
+  uint8_t b = 0;
+  uint8_t a = 0;
 
-// Send `len` bits on the AVCLAN bus; returns the even parity
-uint8_t AVCLAN_sendbitsi(const uint8_t *bits, int8_t len) {
-  uint8_t b = *bits;
-  uint8_t parity = 0;
-  int8_t len_mod8 = 8;
+  txAcks = 0;
 
-  if (len & 0x7) {
-    len_mod8 = (int8_t)(len & 0x7);
-    b <<= (uint8_t)(8 - len_mod8);
-  }
+  TCB1.CNT = 0;
+  AVC_SET_LOGICAL_0();
+  while (TCB1.CNT < (uint16_t)AVCLAN_STARTBIT_LOGIC_0) {}
+  AVC_SET_LOGICAL_1();
+  uint16_t period =
+      (uint16_t)(AVCLAN_STARTBIT_LOGIC_0 + AVCLAN_STARTBIT_LOGIC_1);
 
-  while (len > 0) {
-    len -= len_mod8;
-    for (; len_mod8 > 0; len_mod8--) {
-      if (b & 0x80) {
-        AVCLAN_sendbit_1();
-        parity++;
-      } else {
-        AVCLAN_sendbit_0();
+  for (uint16_t i = 0; i < s->nbits; i++) {
+    if ((i & 0x7) == 0) {
+      b = *bits++;
+      a = *acks++;
+    }
+
+    if (a & 0x80) {
+      while (TCB1.CNT < period) {}
+      if (!AVCLAN_readbit_ACK())
+        return TX_NAK;
+      txAcks++;
+      period = 0; // Peripheral has already released the bus
+    } else {
+      const AVCLAN_txbit_t *t = &txBitTiming[b >> 7];
+      uint16_t logic_0 = t->logic_0;
+      uint16_t next = t->period;
+
+      while (TCB1.CNT < period) {}
+      TCB1.CNT = 0;
+      AVC_SET_LOGICAL_0();
+      while (TCB1.CNT < logic_0) {}
+      AVC_SET_LOGICAL_1();
+      if (i < TX_ARB_BITS && (b & 0x80)) {
+        while (TCB1.CNT < readbitThreshold) {}
+        if (!BUS_IS_IDLE) {
+          txLostBit = i;
+          return TX_LOST;
+        }
       }
-      b <<= 1;
+      period = next;
     }
-    len_mod8 = 8;
-    b = *--bits;
+    b <<= 1;
+    a <<= 1;
   }
-  return (parity & 1);
+  while (TCB1.CNT < period) {}
+
+  return TX_DONE;
 }
 
-// Send `len` bits on the AVCLAN bus; returns the even parity
-uint8_t AVCLAN_sendbitsl(const uint16_t *bits, int8_t len) {
-  return AVCLAN_sendbitsi((const uint8_t *)bits + 1, len);
+// Send the start bit and `s`; the frame is finished before returning
+static void AVCLAN_tx_run(const AVCLAN_txstream_t *s) {
+  txTime = AVCLAN_timestamp();
+  txState = TX_BUSY;
+  AVCLAN_tx_end(AVCLAN_tx_stream(s));
 }
+#endif
 
-uint8_t AVCLAN_sendbyte(const uint8_t *byte) {
-  uint8_t b = *byte;
-  uint8_t parity = 0;
+// Abandon the current frame and record why for the main loop
+static void AVCLAN_rx_error(uint16_t value) {
+  switch (rxState) {
+    case RX_CONTROLLER_PARITY:
+      stats.rx_err_controller_parity++;
+      break;
+    case RX_PERIPHERAL_PARITY:
+      stats.rx_err_peripheral_parity++;
+      break;
+    case RX_CONTROL_PARITY:
+      stats.rx_err_control_parity++;
+      break;
+    case RX_LENGTH_PARITY:
+      stats.rx_err_length_parity++;
+      break;
+    case RX_LENGTH_ACK:
+      stats.rx_err_length++;
+      break;
+    case RX_DATA_PARITY:
+      stats.rx_err_data_parity++;
+      break;
+    default:
+      break;
+  }
+  rxErrState = rxState;
+  rxErrValue = value;
+  rxErrParity = READING_PARITY;
+  AVCLAN_rx_reset();
+}
 
-  for (uint8_t nbits = 8; nbits > 0; nbits--) {
-    if (b & 0x80) {
-      AVCLAN_sendbit_1();
-      parity++;
-    } else {
-      AVCLAN_sendbit_0();
-    }
-    b <<= 1;
+// Even parity is checked by counting the parity bit along with the field bits
+#define RX_PARITY_OK() ((READING_PARITY & 1) == 0)
+
+static uint8_t AVCLAN_rx_accept(const AVCLAN_frame_t *frame) {
+  for (uint8_t i = 0; i < rxFilterCount; i++) {
+    const AVCLAN_filter_t *f = &rxFilter[i];
+    if (((frame->controller_addr ^ f->controller_addr) & f->controller_mask) ==
+            0 &&
+        ((frame->peripheral_addr ^ f->peripheral_addr) & f->peripheral_mask) ==
+            0)
+      return 1;
   }
-  return (parity & 1);
+  return 0;
 }
 
-ISR(TCB0_INT_vect) {
-#ifdef SOFTWARE_DEBUG
-  pulse_count++;
-  period = TCB0.CNT;
+// Add an entry to the acceptance filter; returns 1 if the table is full
+uint8_t AVCLAN_rx_addfilter(uint16_t controller_addr, uint16_t controller_mask,
+                            uint16_t peripheral_addr,
+                            uint16_t peripheral_mask) {
+  if (rxFilterCount == RXFILTER_LEN)
+    return 1;
+
+  AVCLAN_filter_t *f = &rxFilter[rxFilterCount];
+  f->controller_addr = controller_addr;
+  f->controller_mask = controller_mask;
+  f->peripheral_addr = peripheral_addr;
+  f->peripheral_mask = peripheral_mask;
+  rxFilterCount++; // Publish the entry to the ISR last
+
+  return 0;
+}
+
+void AVCLAN_rx_clearfilters() { rxFilterCount = 0; }
+
+/* Capture filter
+
+   Unlike the acceptance filter, which keeps frames from being received at
+   all, the capture filter only decides which frames are logged. A frame is
+   logged if it matches no exclude rule and, when there are include rules, at
+   least one of them; frames that aren't are counted in `stats.log_filtered`.
+
+   A rule is entered on the REPL as a sequence ('S', then hex digits):
+     <bcast> <ctrl lo> <ctrl hi> <periph lo> <periph hi> <control>
+     [<data 0> <mask 0> ... up to CAPFILTER_DATA pairs]
+   - bcast: 00 matches broadcast frames, 01 unicast ones, anything else both
+   - ctrl/periph lo, hi: 12-bit address ranges, two bytes each (big-endian)
+   - control: mask in the high nibble, value in the low nibble
+   - data/mask: the first payload bytes, compared under the masks; shorter
+     frames don't match
+   e.g. 'S', `FF00000FFF019001900011FF`, 'i' only logs frames to the head unit
+   (0x190) whose first payload byte is 0x11. */
+
+#ifndef CAPFILTER_LEN
+  #define CAPFILTER_LEN 8
 #endif
+#define CAPFILTER_DATA 4
+
+#define CAPFILTER_BROADCAST 0x00
+#define CAPFILTER_UNICAST   0x01
+
+typedef struct AVCLAN_capfilter_struct {
+  uint8_t exclude;
+  uint8_t broadcast;
+  uint16_t controller_lo;
+  uint16_t controller_hi;
+  uint16_t peripheral_lo;
+  uint16_t peripheral_hi;
+  uint8_t control; // Mask in the high nibble, value in the low
+  uint8_t length;  // Of `data` and `mask`
+  uint8_t data[CAPFILTER_DATA];
+  uint8_t mask[CAPFILTER_DATA];
+} AVCLAN_capfilter_t;
+
+AVCLAN_capfilter_t capFilter[CAPFILTER_LEN];
+uint8_t capFilterCount;
+uint8_t capFilterIncludes; // Number of include rules
+
+static uint8_t AVCLAN_capfilter_match(const AVCLAN_capfilter_t *f,
+                                      const AVCLAN_frame_t *frame) {
+  if (frame->controller_addr < f->controller_lo ||
+      frame->controller_addr > f->controller_hi ||
+      frame->peripheral_addr < f->peripheral_lo ||
+      frame->peripheral_addr > f->peripheral_hi)
+    return 0;
+  if (f->broadcast <= CAPFILTER_UNICAST && frame->broadcast != f->broadcast)
+    return 0;
+  if ((frame->control ^ f->control) & (f->control >> 4))
+    return 0;
+  if (frame->length < f->length)
+    return 0;
+  for (uint8_t i = 0; i < f->length; i++) {
+    if ((frame->data[i] ^ f->data[i]) & f->mask[i])
+      return 0;
+  }
+  return 1;
+}
 
-  READING_BYTE <<= 1;
-  // If the logical `0` pulse was less than the sync + data period threshold,
-  // bit was a 1
-  pulsewidth = TCB0.CCMP;
-  if (pulsewidth < (uint16_t)AVCLAN_READBIT_THRESHOLD) {
-    READING_BYTE++;
-    READING_PARITY++;
+// Whether `frame` should be logged
+static uint8_t AVCLAN_capture_accept(const AVCLAN_frame_t *frame) {
+  uint8_t accept = (capFilterIncludes == 0);
+  for (uint8_t i = 0; i < capFilterCount; i++) {
+    const AVCLAN_capfilter_t *f = &capFilter[i];
+    if (!AVCLAN_capfilter_match(f, frame))
+      continue;
+    if (f->exclude) {
+      accept = 0;
+      break;
+    }
+    accept = 1;
   }
-  READING_NBITS--;
+
+  if (!accept)
+    stats.log_filtered++;
+  return accept;
+}
+
+// Add a capture filter rule, encoded as described above; returns 1 if it is
+// malformed or the table is full
+uint8_t AVCLAN_capture_addfilter(const uint8_t *bytes, uint8_t len,
+                                 uint8_t exclude) {
+  if (len < 10 || (len & 1) || len > 10 + 2 * CAPFILTER_DATA ||
+      capFilterCount == CAPFILTER_LEN)
+    return 1;
+
+  AVCLAN_capfilter_t *f = &capFilter[capFilterCount];
+  f->exclude = exclude;
+  f->broadcast = bytes[0];
+  f->controller_lo = ((uint16_t)bytes[1] << 8) | bytes[2];
+  f->controller_hi = ((uint16_t)bytes[3] << 8) | bytes[4];
+  f->peripheral_lo = ((uint16_t)bytes[5] << 8) | bytes[6];
+  f->peripheral_hi = ((uint16_t)bytes[7] << 8) | bytes[8];
+  f->control = bytes[9];
+  f->length = (len - 10) / 2;
+  for (uint8_t i = 0; i < f->length; i++) {
+    f->data[i] = bytes[10 + 2 * i];
+    f->mask[i] = bytes[11 + 2 * i];
+  }
+
+  capFilterCount++;
+  if (!exclude)
+    capFilterIncludes++;
+  return 0;
 }
 
-#define AVCLAN_readbits(bits, len)                                             \
-  _Generic((bits),                                                             \
-      const uint16_t *: AVCLAN_readbitsl,                                      \
-      uint16_t *: AVCLAN_readbitsl,                                            \
-      const uint8_t *: AVCLAN_readbitsi,                                       \
-      uint8_t *: AVCLAN_readbitsi)(bits, len)
+void AVCLAN_capture_clearfilters() { capFilterCount = capFilterIncludes = 0; }
+
+// Print the capture filter rules as they were entered; '+' includes, '-'
+// excludes
+void AVCLAN_capture_printfilters() {
+  if (capFilterCount == 0)
+    RS232_Print("No capture filter rules; logging every frame\n");
+
+  for (uint8_t i = 0; i < capFilterCount; i++) {
+    const AVCLAN_capfilter_t *f = &capFilter[i];
+    RS232_Print(f->exclude ? "- " : "+ ");
+    RS232_PrintHex8(f->broadcast);
+    RS232_Print(" ");
+    RS232_PrintHex16(f->controller_lo);
+    RS232_Print(" ");
+    RS232_PrintHex16(f->controller_hi);
+    RS232_Print(" ");
+    RS232_PrintHex16(f->peripheral_lo);
+    RS232_Print(" ");
+    RS232_PrintHex16(f->peripheral_hi);
+    RS232_Print(" ");
+    RS232_PrintHex8(f->control);
+    for (uint8_t j = 0; j < f->length; j++) {
+      RS232_Print(" ");
+      RS232_PrintHex8(f->data[j]);
+      RS232_PrintHex8(f->mask[j]);
+    }
+    RS232_Print("\n");
+  }
+}
+
+// The logical `0` pulses of bit `1`s (~20 us) and bit `0`s (~33 us) form two
+// clusters; when calibration is enabled the read threshold follows the midpoint
+// of their running means, but never closer than 1/4 of the nominal separation
+// to either nominal pulse-width.
+#define READBIT_THRESHOLD_MIN                                                  \
+  (uint16_t)(AVCLAN_BIT1_LOGIC_0 +                                             \
+             (AVCLAN_BIT0_LOGIC_0 - AVCLAN_BIT1_LOGIC_0) / 4)
+#define READBIT_THRESHOLD_MAX                                                  \
+  (uint16_t)(AVCLAN_BIT0_LOGIC_0 -                                             \
+             (AVCLAN_BIT0_LOGIC_0 - AVCLAN_BIT1_LOGIC_0) / 4)
+#define CALIB_MIN_SAMPLES 32
+
+typedef struct AVCLAN_cluster_struct {
+  uint16_t mean8; // Exponential moving average (alpha = 1/8), times 8
+  uint16_t min;
+  uint16_t max;
+  uint16_t count;
+} AVCLAN_cluster_t;
+
+uint8_t calibEnabled;
+AVCLAN_cluster_t calibShort; // Bit `1`s
+AVCLAN_cluster_t calibLong;  // Bit `0`s
+
+// Histogram bins are 1/8 of the nominal threshold wide, from 5/8 to 11/8 of it
+const uint16_t calibEdges[] = {
+    (uint16_t)(AVCLAN_READBIT_THRESHOLD * 5 / 8),
+    (uint16_t)(AVCLAN_READBIT_THRESHOLD * 6 / 8),
+    (uint16_t)(AVCLAN_READBIT_THRESHOLD * 7 / 8),
+    (uint16_t)(AVCLAN_READBIT_THRESHOLD * 8 / 8),
+    (uint16_t)(AVCLAN_READBIT_THRESHOLD * 9 / 8),
+    (uint16_t)(AVCLAN_READBIT_THRESHOLD * 10 / 8),
+    (uint16_t)(AVCLAN_READBIT_THRESHOLD * 11 / 8),
+};
+uint16_t calibHist[8];
+
+// Record the width of a decoded bit; called from the TCB0 ISR
+static inline void AVCLAN_calib_sample(uint16_t width) {
+  if (width >= (uint16_t)AVCLAN_BIT_LENGTH_MAX)
+    return; // Start bit (or noise)
+
+  AVCLAN_cluster_t *c = (width < readbitThreshold) ? &calibShort : &calibLong;
+  if (c->count == 0)
+    c->mean8 = width << 3;
+  else
+    c->mean8 += width - (c->mean8 >> 3);
+  if (c->count != UINT16_MAX)
+    c->count++;
+  if (width < c->min)
+    c->min = width;
+  if (width > c->max)
+    c->max = width;
+
+  uint8_t bin = (width < calibEdges[3]) ? 0 : 4;
+  if (width >= calibEdges[bin + 1])
+    bin += 2;
+  if (width >= calibEdges[bin])
+    bin += 1;
+  if (calibHist[bin] != UINT16_MAX)
+    calibHist[bin]++;
+}
 
-// Read `len` bits on the AVCLAN bus; returns the even parity
-uint8_t AVCLAN_readbitsi(uint8_t *bits, uint8_t len) {
+void AVCLAN_calib_reset() {
   cli();
-  READING_BYTE = 0;
-  READING_PARITY = 0;
-  READING_NBITS = len;
+  calibShort = calibLong = (AVCLAN_cluster_t){.min = UINT16_MAX};
+  memset(calibHist, 0, sizeof(calibHist));
+  readbitThreshold = (uint16_t)AVCLAN_READBIT_THRESHOLD;
   sei();
+}
 
-  TCB1.CNT = 0;
-  while (READING_NBITS != 0) {
-    // 200% the duration of `len` bits
-    if (TCB1.CNT > ((uint16_t)AVCLAN_BIT_LENGTH_MAX * 2 * len)) {
-      READING_BYTE = 0;
-      READING_PARITY = 0;
-      break; // Should have finished by now; something's wrong
-    }
-  };
+// Move the read threshold to the midpoint between the two clusters
+static void AVCLAN_calib_update() {
+  if (!calibEnabled)
+    return;
 
   cli();
-  *bits = READING_BYTE;
-  uint8_t parity = READING_PARITY;
+  uint16_t mean_short = calibShort.mean8;
+  uint16_t mean_long = calibLong.mean8;
+  uint8_t ready = (calibShort.count >= CALIB_MIN_SAMPLES) &&
+                  (calibLong.count >= CALIB_MIN_SAMPLES);
   sei();
 
-  return (parity & 1);
+  if (!ready)
+    return;
+
+  uint16_t threshold = (mean_short + mean_long) >> 4;
+  if (threshold < READBIT_THRESHOLD_MIN)
+    threshold = READBIT_THRESHOLD_MIN;
+  else if (threshold > READBIT_THRESHOLD_MAX)
+    threshold = READBIT_THRESHOLD_MAX;
+
+  cli();
+  readbitThreshold = threshold;
+  sei();
 }
 
-// Read `len` bits on the AVCLAN bus; returns the even parity
-uint8_t AVCLAN_readbitsl(uint16_t *bits, int8_t len) {
-  uint8_t parity = 0;
-  if (len > 8) {
-    uint8_t over = len - 8;
-    parity = AVCLAN_readbitsi((uint8_t *)bits + 1, over);
-    len -= over;
+static void AVCLAN_calib_printcluster(const char *name,
+                                      const AVCLAN_cluster_t *c,
+                                      int16_t margin) {
+  RS232_Print(name);
+  RS232_Print(" mean 0x");
+  RS232_PrintHex12(c->mean8 >> 3);
+  RS232_Print(", min 0x");
+  RS232_PrintHex12(c->min);
+  RS232_Print(", max 0x");
+  RS232_PrintHex12(c->max);
+  RS232_Print(", margin ");
+  if (margin < 0) {
+    RS232_Print("-");
+    margin = -margin;
   }
-  parity += AVCLAN_readbitsi((uint8_t *)bits + 0, len);
-
-  return (parity & 1);
+  RS232_Print("0x");
+  RS232_PrintHex12(margin);
+  RS232_Print("\n");
 }
 
-// Read a byte on the AVCLAN bus
-uint8_t AVCLAN_readbyte(uint8_t *byte) {
+// Print the read threshold and the pulse-width statistics (in TCB ticks)
+void AVCLAN_calib_print() {
   cli();
-  READING_BYTE = 0;
-  READING_PARITY = 0;
-  READING_NBITS = 8;
+  AVCLAN_cluster_t s = calibShort;
+  AVCLAN_cluster_t l = calibLong;
+  uint16_t threshold = readbitThreshold;
+  uint16_t hist[8];
+  memcpy(hist, calibHist, sizeof(hist));
   sei();
 
-  TCB1.CNT = 0;
-  while (READING_NBITS != 0) {
-    // 200% the length of a byte
-    if (TCB1.CNT > ((uint16_t)AVCLAN_BIT_LENGTH_MAX * 2 * 8)) {
-      READING_BYTE = 0;
-      READING_PARITY = 0;
-      break; // Should have finished by now; something's wrong
-    }
-  };
+  RS232_Print("Threshold 0x");
+  RS232_PrintHex12(threshold);
+  RS232_Print(" (nominal 0x");
+  RS232_PrintHex12((uint16_t)AVCLAN_READBIT_THRESHOLD);
+  RS232_Print(")\n");
+  AVCLAN_calib_printcluster("Bit 1:", &s, threshold - s.max);
+  AVCLAN_calib_printcluster("Bit 0:", &l, l.min - threshold);
+  RS232_Print("Histogram:");
+  for (uint8_t i = 0; i < 8; i++) {
+    RS232_Print(" 0x");
+    RS232_PrintHex8(*(((uint8_t *)&hist[i]) + 1));
+    RS232_PrintHex8(*(((uint8_t *)&hist[i]) + 0));
+  }
+  RS232_Print("\n");
+}
 
-  cli();
-  *byte = READING_BYTE;
-  uint8_t parity = READING_PARITY;
-  sei();
+// A start bit is measured by the same TCB0 capture as every other bit, so its
+// length doesn't depend on how quickly the main loop notices bus activity.
+// `time` is when the start bit began.
+static void AVCLAN_rx_startbit(uint32_t time) {
+  if (rxState != RX_IDLE && rxState < RX_SKIP_ADDRESS) {
+    // Lost the end of the current frame
+    stats.rx_err_truncated++;
+    rxErrState = RX_ERR_TRUNCATED;
+    rxErrValue = rxState;
+  }
+
+  if (pulsewidth < RX_STARTBIT_MIN || pulsewidth > RX_STARTBIT_MAX) {
+    stats.rx_err_startbit++;
+    rxErrState = RX_ERR_STARTBIT;
+    rxErrValue = pulsewidth;
+    AVCLAN_rx_reset();
+    return;
+  }
 
-  return (parity & 1);
+  READING_PARITY = 0;
+  if ((uint8_t)(rxWrite - rxRead) == AVCLAN_RX_SLOTS) {
+    stats.rx_overflow++;
+    AVCLAN_rx_next(RX_SKIP_ADDRESS, 27);
+    return;
+  }
+  rxFrame = &rxQueue[rxMask(rxWrite)];
+  rxTime[rxMask(rxWrite)] = time;
+#ifdef AVCLAN_RX_DEFERRED
+  rxMargin[rxMask(rxWrite)] = UINT16_MAX;
+#endif
+  AVCLAN_rx_next(RX_BROADCAST, 1);
 }
 
-uint8_t AVCLAN_readframe() {
-  STOPEvent; // disable timer1 interrupt
+// Timestamp of the end of the start bit in `pulsewidth`
+static inline uint32_t AVCLAN_rx_starttime() {
+#ifdef AVCLAN_RX_DEFERRED
+  while (!rxReplay && startStampRead != startStampWrite) {
+    const AVCLAN_stamp_t *stamp =
+        &startStamps[startStampRead & (START_STAMPS - 1)];
+    int8_t ahead = stamp->pulse - pulseCurrent;
+    if (ahead > 0)
+      break; // This start bit's stamp was lost; use the time now
+    startStampRead++;
+    if (ahead == 0)
+      return stamp->time;
+    // else the stamp of a start bit the decoder didn't time
+  }
+#endif
+  return AVCLAN_timestamp();
+}
 
-  uint8_t data[MAXMSGLEN];
-  AVCLAN_frame_t frame = {
-      .data = data,
-  };
+// Called by the TCB0 ISR every time the `READING_NBITS` of a field have been
+// read; stores the field and sets up the next one
+void AVCLAN_rx_field() {
+  uint8_t byte = READING_BYTE;
 
-  uint8_t parity = 0;
-  uint8_t tmp = 0;
+  if ((pulsewidth >> 8) >= RX_STARTBIT_HI) {
+    AVCLAN_rx_startbit(
+        AVCLAN_timestamp_before(AVCLAN_rx_starttime(), pulsewidth));
+    return;
+  }
 
-  TCB1.CNT = 0;
-  while (!BUS_IS_IDLE) {
-    if (TCB1.CNT > (uint16_t)AVCLAN_STARTBIT_LOGIC_0 * 1.2) {
-      STARTEvent;
-      return 0;
+  if (rxState != RX_IDLE)
+    AVCLAN_calib_sample(pulsewidth);
+
+  switch (rxState) {
+    case RX_IDLE:
+      // Not a start bit; noise or the middle of a frame we didn't see the
+      // beginning of
+      AVCLAN_rx_reset();
+      break;
+    case RX_BROADCAST:
+      rxFrame->broadcast = byte;
+      READING_PARITY = 0;
+      AVCLAN_rx_next(RX_CONTROLLER_HI, 4);
+      break;
+    case RX_CONTROLLER_HI:
+      rxFrame->controller_addr = (uint16_t)byte << 8;
+      AVCLAN_rx_next(RX_CONTROLLER_LO, 8);
+      break;
+    case RX_CONTROLLER_LO:
+      rxFrame->controller_addr |= byte;
+      AVCLAN_rx_next(RX_CONTROLLER_PARITY, 1);
+      break;
+    case RX_CONTROLLER_PARITY:
+      if (!RX_PARITY_OK()) {
+        AVCLAN_rx_error(rxFrame->controller_addr);
+        break;
+      }
+      READING_PARITY = 0;
+      AVCLAN_rx_next(RX_PERIPHERAL_HI, 4);
+      break;
+    case RX_PERIPHERAL_HI:
+      rxFrame->peripheral_addr = (uint16_t)byte << 8;
+      AVCLAN_rx_next(RX_PERIPHERAL_LO, 8);
+      break;
+    case RX_PERIPHERAL_LO:
+      rxFrame->peripheral_addr |= byte;
+      AVCLAN_rx_next(RX_PERIPHERAL_PARITY, 1);
+      break;
+    case RX_PERIPHERAL_PARITY:
+      if (!RX_PARITY_OK()) {
+        AVCLAN_rx_error(rxFrame->peripheral_addr);
+        break;
+      }
+#ifdef AVCLAN_RX_DEFERRED
+      // Too late to acknowledge anything by the time the bit is decoded
+      rxShouldACK = 0;
+#else
+      rxShouldACK = !rxReplay && !AVCLAN_ismuted() &&
+                    (rxFrame->peripheral_addr == DEVICE_ADDR);
+#endif
+      if (rxFilterEnabled && !AVCLAN_rx_accept(rxFrame)) {
+        stats.rx_filtered++;
+        AVCLAN_rx_next(RX_SKIP_CONTROL, 7);
+        break;
+      }
+      goto ACK;
+    case RX_PERIPHERAL_ACK:
+      READING_PARITY = 0;
+      AVCLAN_rx_next(RX_CONTROL, 4);
+      break;
+    case RX_CONTROL:
+      rxFrame->control = byte;
+      AVCLAN_rx_next(RX_CONTROL_PARITY, 1);
+      break;
+    case RX_CONTROL_PARITY:
+      if (!RX_PARITY_OK()) {
+        AVCLAN_rx_error(rxFrame->control);
+        break;
+      }
+      goto ACK;
+    case RX_CONTROL_ACK:
+      READING_PARITY = 0;
+      AVCLAN_rx_next(RX_LENGTH, 8);
+      break;
+    case RX_LENGTH:
+      rxFrame->length = byte;
+      AVCLAN_rx_next(RX_LENGTH_PARITY, 1);
+      break;
+    case RX_LENGTH_PARITY:
+      if (!RX_PARITY_OK()) {
+        AVCLAN_rx_error(rxFrame->length);
+        break;
+      }
+      goto ACK;
+    case RX_LENGTH_ACK:
+      if (rxFrame->length == 0 || rxFrame->length > MAXMSGLEN) {
+        AVCLAN_rx_error(rxFrame->length);
+        break;
+      }
+      rxDataIdx = 0;
+      READING_PARITY = 0;
+      AVCLAN_rx_next(RX_DATA, 8);
+      break;
+    case RX_DATA:
+      rxFrame->data[rxDataIdx] = byte;
+      AVCLAN_rx_next(RX_DATA_PARITY, 1);
+      break;
+    case RX_DATA_PARITY:
+      if (!RX_PARITY_OK()) {
+        AVCLAN_rx_error(rxFrame->data[rxDataIdx]);
+        break;
+      }
+      goto ACK;
+    case RX_DATA_ACK:
+      if (++rxDataIdx < rxFrame->length) {
+        READING_PARITY = 0;
+        AVCLAN_rx_next(RX_DATA, 8);
+      } else {
+        stats.rx_frames++;
+        stats.rx_bytes += rxFrame->length;
+        rxWrite++; // Frame complete; hand off to the main loop
+        AVCLAN_rx_reset();
+      }
+      break;
+    case RX_SKIP_ADDRESS:
+      AVCLAN_rx_next(RX_SKIP_CONTROL, 7);
+      break;
+    case RX_SKIP_CONTROL:
+      AVCLAN_rx_next(RX_SKIP_LENGTH, 8);
+      break;
+    case RX_SKIP_LENGTH:
+      if (byte == 0 || byte > MAXMSGLEN) {
+        AVCLAN_rx_reset();
+        break;
+      }
+      rxSkipBits = 2 + 10 * byte;
+      // fall through
+    case RX_SKIP_DATA:
+      // Skip the rest of the frame in as few fields as possible so that each
+      // bit only takes the short path through the ISR
+      if (rxSkipBits == 0) {
+        AVCLAN_rx_reset();
+      } else if (rxSkipBits > 255) {
+        rxSkipBits -= 255;
+        AVCLAN_rx_next(RX_SKIP_DATA, 255);
+      } else {
+        AVCLAN_rx_next(RX_SKIP_DATA, rxSkipBits);
+        rxSkipBits = 0;
+      }
+      break;
+    default:
+      AVCLAN_rx_reset();
+      break;
+    ACK:
+      // Each *_PARITY state is followed by its *_ACK state. The controller
+      // starts the acknowledge bit as soon as the parity bit ends, so it must
+      // be extended now rather than when the ACK bit is read.
+      if (rxShouldACK)
+        AVCLAN_sendbit_ACK();
+      AVCLAN_rx_next(rxState + 1, 1);
+      break;
+  }
+}
+
+// Decode one bit from the width of its logical `0` pulse
+static inline void AVCLAN_rx_pulse(uint16_t width) {
+  pulsewidth = width;
+
+  if ((width >> 8) >= RX_STARTBIT_HI) {
+    AVCLAN_rx_field(); // Starts a new frame
+    return;
+  }
+
+  READING_BYTE <<= 1;
+  // If the logical `0` pulse was less than the sync + data period threshold,
+  // bit was a 1
+  if (width < readbitThreshold) {
+    READING_BYTE++;
+    READING_PARITY++;
+  }
+#ifdef AVCLAN_RX_DEFERRED
+  uint16_t margin = (width < readbitThreshold) ? readbitThreshold - width
+                                               : width - readbitThreshold;
+  // Skipped frames have no slot of their own; `rxWrite` may be an unread one
+  if (rxState != RX_IDLE && rxState < RX_SKIP_ADDRESS &&
+      margin < rxMargin[rxMask(rxWrite)])
+    rxMargin[rxMask(rxWrite)] = margin;
+#endif
+  READING_NBITS--;
+  if (READING_NBITS == 0)
+    AVCLAN_rx_field();
+}
+
+#ifdef AVCLAN_RX_DEFERRED
+ISR(TCB0_INT_vect) {
+  uint16_t width = TCB0.CCMP; // Also clears the capture flag
+
+  #ifdef SOFTWARE_DEBUG
+  pulse_count++;
+  period = TCB0.CNT;
+  pulsewidth = width;
+  #endif
+
+  uint8_t w = pulseWrite;
+  if ((uint8_t)(w - pulseRead) == PULSE_FIFO_LEN) {
+    stats.rx_pulses_lost++;
+    if (!pulseGap) {
+      pulseGapAt = w;
+      pulseGap = 1;
     }
+    return;
   }
-  uint16_t startbitlen = TCB1.CNT;
-  if (startbitlen < (uint16_t)(AVCLAN_STARTBIT_LOGIC_0 * 0.8)) {
-    RS232_Print("ERR: 1.\n");
-    STARTEvent;
-    return 0;
-  }
-  // Otherwise that was a start bit
-
-  AVCLAN_readbits((uint8_t *)&frame.broadcast, 1);
-
-  parity = AVCLAN_readbits(&frame.controller_addr, 12);
-  AVCLAN_readbits(&tmp, 1);
-  if (parity != (tmp & 1)) {
-    RS232_Print("ERR: Bad controller addr. parity");
-    if (verbose) {
-      RS232_Print("; read 0x");
-      RS232_PrintHex12(frame.controller_addr);
-      RS232_Print(" and calculated parity=");
-      RS232_PrintHex4(parity);
-      RS232_Print(" but got ");
-      RS232_PrintHex4(tmp & 1);
+  pulseFifo[w & (PULSE_FIFO_LEN - 1)].width = width;
+  pulseFifo[w & (PULSE_FIFO_LEN - 1)].time = rtcNow();
+  if ((width >> 8) >= RX_STARTBIT_HI) {
+    uint8_t s = startStampWrite;
+    if ((uint8_t)(s - startStampRead) == START_STAMPS) {
+      stats.rx_stamps_lost++;
+    } else {
+      startStamps[s & (START_STAMPS - 1)].time = AVCLAN_timestamp_isr();
+      startStamps[s & (START_STAMPS - 1)].pulse = w;
+      startStampWrite = s + 1;
     }
-    RS232_Print(".\n");
-    STARTEvent;
-    return 0;
   }
+  pulseWrite = w + 1;
+}
 
-  parity = AVCLAN_readbits(&frame.peripheral_addr, 12);
-  AVCLAN_readbits(&tmp, 1);
-  if (parity != (tmp & 1)) {
-    RS232_Print("Bad peripheral addr. parity");
-    if (verbose) {
-      RS232_Print("; read 0x");
-      RS232_PrintHex12(frame.peripheral_addr);
-      RS232_Print(" and calculated parity=");
-      RS232_PrintHex4(parity);
-      RS232_Print(" but got ");
-      RS232_PrintHex4(tmp & 1);
+// Decode all pulses captured since the last call
+void AVCLAN_rx_process() {
+  uint8_t r = pulseRead;
+  while (r != pulseWrite) {
+    const AVCLAN_pulse_t *p = &pulseFifo[r & (PULSE_FIFO_LEN - 1)];
+
+    // A frame has no gaps longer than a bit (~1 RTC tick); anything longer
+    // means the frame was cut short and the decoder needs to resynchronise.
+    // So does a pulse lost to a full FIFO, or the frame would be a bit short.
+    if (pulseGap && r == pulseGapAt) {
+      pulseGap = 0;
+      AVCLAN_rx_reset();
     }
-    RS232_Print(".\n");
-    STARTEvent;
-    return 0;
+    if (rxState != RX_IDLE && (uint16_t)(p->time - pulseLastTime) > 4)
+      AVCLAN_rx_reset();
+    pulseLastTime = p->time;
+
+    pulseCurrent = r;
+    AVCLAN_rx_pulse(p->width);
+    pulseRead = ++r; // Release the entry to the ISR
   }
+}
+#elif defined(SOFTWARE_DEBUG)
+ISR(TCB0_INT_vect) {
+  pulse_count++;
+  period = TCB0.CNT;
 
-  uint8_t shouldACK =
-      !AVCLAN_ismuted() && (frame.peripheral_addr == DEVICE_ADDR);
+  AVCLAN_rx_pulse(TCB0.CCMP);
+}
+#else
+/* Hand-scheduled equivalent of `AVCLAN_rx_pulse(TCB0.CCMP)`. The bit state
+   lives in the GPIORs, so the per-bit path only needs r24/r25 and SREG; the
+   call-clobbered registers are saved only when a field is complete and
+   `AVCLAN_rx_field` has to run.
+
+   Cycle counts (AVRxt instruction timing, including the 2 cycle interrupt
+   response and the 3 cycle vector JMP):
+     - Bit `1`, field not complete: 55 cycles
+     - Bit `0`, field not complete: 53 cycles
+     - Field complete:              +36 cycles, plus `AVCLAN_rx_field`
+
+   The ISR must read CCMP before the next capture. Captures are at least
+   24.3 us apart (6.2 us idle of a `0` followed by the 18.1 us pulse of a `1`).
+
+     F_CPU (FREQSEL/CLK_PRESCALE_DIV) │ 55 cycles
+     ─────────────────────────────────┼──────────
+     20 MHz                           │  2.75 us
+     16 MHz                           │  3.44 us
+     20 MHz / 2  (10 MHz)             │  5.5 us
+     16 MHz / 2  (8 MHz)              │  6.88 us
+     20 MHz / 4  (5 MHz)              │ 11 us
+     16 MHz / 4  (4 MHz)              │ 13.75 us
+     20 MHz / 8  (2.5 MHz)            │ 22 us
+     16 MHz / 8  (2 MHz)              │ 27.5 us (too slow)
+
+   With a prescaler of 8 or more there is no room left for
+   `AVCLAN_rx_field` (or for sending ACK bits, which busy-waits for a bit
+   length inside the ISR). The threshold is read from `readbitThreshold` so
+   that it can be calibrated at runtime; a compile-time threshold saves 9
+   cycles. */
+ISR(TCB0_INT_vect, ISR_NAKED) {
+  // clang-format off
+  __asm__ __volatile__(
+      "push r24                    \n\t"
+      "in   r24, %[sreg]           \n\t"
+      "push r24                    \n\t"
+      "push r25                    \n\t"
+      "push r0                     \n\t"
+      "lds  r24, %[ccmp]           ; Low byte first; also clears CAPT \n\t"
+      "lds  r25, %[ccmp]+1         \n\t"
+      "sts  pulsewidth, r24        \n\t"
+      "sts  pulsewidth+1, r25      \n\t"
+      "cpi  r25, %[start_hi]       \n\t"
+      "brsh 3f                     ; Start bit; handled by AVCLAN_rx_field\n\t"
+      "lds  r0, readbitThreshold   \n\t"
+      "cp   r24, r0                \n\t"
+      "lds  r0, readbitThreshold+1 \n\t"
+      "cpc  r25, r0                ; Carry is set if the bit was a `1` \n\t"
+      "brcc 1f                     \n\t"
+      "in   r25, %[parity]         \n\t"
+      "inc  r25                    ; Leaves the carry alone \n\t"
+      "out  %[parity], r25         \n"
+      "1:                          \n\t"
+      "in   r24, %[byte]           \n\t"
+      "rol  r24                    ; Shift the bit into READING_BYTE \n\t"
+      "out  %[byte], r24           \n\t"
+      "in   r25, %[nbits]          \n\t"
+      "dec  r25                    \n\t"
+      "out  %[nbits], r25          \n\t"
+      "brne 2f                     \n"
+      "3:                          \n\t"
+      "push r1                     ; Field complete; save what the call may\n\t"
+      "push r18                    ; clobber \n\t"
+      "push r19                    \n\t"
+      "push r20                    \n\t"
+      "push r21                    \n\t"
+      "push r22                    \n\t"
+      "push r23                    \n\t"
+      "push r26                    \n\t"
+      "push r27                    \n\t"
+      "push r30                    \n\t"
+      "push r31                    \n\t"
+      "clr  r1                     \n\t"
+      "call AVCLAN_rx_field        \n\t"
+      "pop  r31                    \n\t"
+      "pop  r30                    \n\t"
+      "pop  r27                    \n\t"
+      "pop  r26                    \n\t"
+      "pop  r23                    \n\t"
+      "pop  r22                    \n\t"
+      "pop  r21                    \n\t"
+      "pop  r20                    \n\t"
+      "pop  r19                    \n\t"
+      "pop  r18                    \n\t"
+      "pop  r1                     \n"
+      "2:                          \n\t"
+      "pop  r0                     \n\t"
+      "pop  r25                    \n\t"
+      "pop  r24                    \n\t"
+      "out  %[sreg], r24           \n\t"
+      "pop  r24                    \n\t"
+      "reti                        \n\t"
+      ::
+      [sreg] "I"(_SFR_IO_ADDR(SREG)),
+      [byte] "I"(_SFR_IO_ADDR(READING_BYTE)),
+      [nbits] "I"(_SFR_IO_ADDR(READING_NBITS)),
+      [parity] "I"(_SFR_IO_ADDR(READING_PARITY)),
+      [ccmp] "n"(_SFR_MEM_ADDR(TCB0_CCMP)),
+      [start_hi] "M"(RX_STARTBIT_HI));
+  // clang-format on
+}
+#endif
 
-  if (shouldACK)
-    AVCLAN_sendbit_ACK();
-  else
-    AVCLAN_readbits(&tmp, 1);
-
-  parity = AVCLAN_readbits(&frame.control, 4);
-  AVCLAN_readbits(&tmp, 1);
-  if (parity != (tmp & 1)) {
-    RS232_Print("Bad control parity");
-    if (verbose) {
-      RS232_Print("; read 0x");
-      RS232_PrintHex4(frame.control);
-      RS232_Print(" and calculated parity=");
-      RS232_PrintHex4(parity);
-      RS232_Print(" but got ");
-      RS232_PrintHex4(tmp & 1);
-    }
-    RS232_Print(".\n");
-    STARTEvent;
-    return 0;
-  } else if (shouldACK) {
-    AVCLAN_sendbit_ACK();
-  } else {
-    AVCLAN_readbits(&tmp, 1);
-  }
-
-  parity = AVCLAN_readbyte(&frame.length);
-  AVCLAN_readbits(&tmp, 1);
-  if (parity != (tmp & 1)) {
-    RS232_Print("Bad length parity");
-    if (verbose) {
-      RS232_Print("; read 0x");
-      RS232_PrintHex4(frame.length);
-      RS232_Print(" and calculated parity=");
-      RS232_PrintHex4(parity);
-      RS232_Print(" but got ");
-      RS232_PrintHex4(tmp & 1);
-    }
-    RS232_Print(".\n");
-    STARTEvent;
-    return 0;
-  } else if (shouldACK) {
-    AVCLAN_sendbit_ACK();
+// Stop decoding while we drive the bus ourselves
+static inline void AVCLAN_rx_pause() {
+  cbi(TCB0.INTCTRL, TCB_CAPT_bp);
+#ifdef AVCLAN_RX_DEFERRED
+  AVCLAN_rx_process(); // Finish any frame still waiting in the FIFO
+#endif
+}
+
+static inline void AVCLAN_rx_resume() {
+  AVCLAN_rx_reset();
+  TCB0.INTFLAGS = TCB_CAPT_bm; // Discard the capture of our own last bit
+  sbi(TCB0.INTCTRL, TCB_CAPT_bp);
+}
+
+/* Put the decoder where it would be after the start bit and the first `nbits`
+   of `arb` (the broadcast bit and controller address, MSB first). Used after
+   losing arbitration, when those bits were on the bus while RX was paused. */
+static void AVCLAN_rx_resync(uint16_t arb, uint8_t nbits) {
+  AVCLAN_rx_reset();
+  pulsewidth = (uint16_t)AVCLAN_STARTBIT_LOGIC_0;
+  AVCLAN_rx_startbit(txTime); // Both start bits began together
+#ifdef AVCLAN_RX_DEFERRED
+  pulseLastTime = rtcNow();
+#endif
+
+  if (rxState == RX_SKIP_ADDRESS) {
+    READING_NBITS -= nbits;
+    return;
+  }
+  if (nbits == 0)
+    return;
+
+  rxFrame->broadcast = (arb >> 12) & 1;
+
+  // Controller address bits read so far
+  uint8_t n = nbits - 1;
+  uint16_t addr = arb & 0xFFF;
+  if (n < 4) {
+    AVCLAN_rx_next(RX_CONTROLLER_HI, 4 - n);
+    READING_BYTE = (uint8_t)(addr >> (12 - n));
+  } else if (n < 12) {
+    rxFrame->controller_addr = addr & 0xF00;
+    AVCLAN_rx_next(RX_CONTROLLER_LO, 12 - n);
+    READING_BYTE = (uint8_t)((addr & 0xFF) >> (12 - n));
   } else {
-    AVCLAN_readbits(&tmp, 1);
+    rxFrame->controller_addr = addr;
+    AVCLAN_rx_next(RX_CONTROLLER_PARITY, 1);
   }
+  READING_PARITY = __builtin_parity(addr >> (12 - n));
+}
 
-  if (frame.length == 0 || frame.length > MAXMSGLEN) {
-    RS232_Print("Bad length; got 0x");
-    RS232_PrintHex4(frame.length);
-    RS232_Print(".\n");
-    STARTEvent;
-    return 0;
+// Feed previously captured pulse-widths (in TCB ticks) through the receive
+// decoder; any frames found are handled exactly like received frames. No ACKs
+// are sent for replayed frames.
+void AVCLAN_rx_replay(const uint16_t *widths, uint8_t len) {
+  AVCLAN_rx_pause();
+  AVCLAN_rx_reset();
+  rxReplay = 1;
+  for (uint8_t i = 0; i < len; i++)
+    AVCLAN_rx_pulse(widths[i]);
+  rxReplay = 0;
+  AVCLAN_rx_resume();
+}
+
+// Print the most recent receive error, if there was one
+static void AVCLAN_printerror() {
+  cli();
+  uint16_t overflow = stats.rx_overflow;
+  sei();
+  if (overflow != rxOverflowReported) {
+    RS232_Print("ERR: RX slots full; dropped 0x");
+    RS232_PrintHex16(overflow - rxOverflowReported);
+    RS232_Print(" frames.\n");
+    rxOverflowReported = overflow;
   }
 
-  for (uint8_t i = 0; i < frame.length; i++) {
-    parity = AVCLAN_readbyte(&frame.data[i]);
-    AVCLAN_readbits(&tmp, 1);
-    if (parity != (tmp & 1)) {
-      RS232_Print("Bad data parity");
+  cli();
+  AVCLAN_rxstate_t state = rxErrState;
+  uint16_t value = rxErrValue;
+  uint8_t parity = rxErrParity;
+  rxErrState = RX_IDLE;
+  sei();
+
+  switch (state) {
+    case RX_IDLE:
+      return;
+    case RX_ERR_STARTBIT:
+      RS232_Print("ERR: 1.");
       if (verbose) {
-        RS232_Print("; read 0x");
-        RS232_PrintHex4(frame.data[i]);
-        RS232_Print(" and calculated parity=");
-        RS232_PrintHex4(parity);
-        RS232_Print(" but got ");
-        RS232_PrintHex4(tmp & 1);
+        RS232_Print(" Start bit was 0x");
+        RS232_PrintHex16(value);
+        RS232_Print(" ticks.");
       }
+      RS232_Print("\n");
+      return;
+    case RX_ERR_TRUNCATED:
+      RS232_Print("ERR: Frame cut short by a start bit.\n");
+      return;
+    case RX_CONTROLLER_PARITY:
+      RS232_Print("ERR: Bad controller addr. parity");
+      break;
+    case RX_PERIPHERAL_PARITY:
+      RS232_Print("Bad peripheral addr. parity");
+      break;
+    case RX_CONTROL_PARITY:
+      RS232_Print("Bad control parity");
+      break;
+    case RX_LENGTH_PARITY:
+      RS232_Print("Bad length parity");
+      break;
+    case RX_LENGTH_ACK:
+      RS232_Print("Bad length; got 0x");
+      RS232_PrintHex8(value);
       RS232_Print(".\n");
-      STARTEvent;
-      return 0;
-    } else if (shouldACK) {
-      AVCLAN_sendbit_ACK();
-    } else {
-      AVCLAN_readbits(&tmp, 1);
-    }
+      return;
+    case RX_DATA_PARITY:
+      RS232_Print("Bad data parity");
+      break;
+    default:
+      return;
+  }
+  if (verbose) {
+    RS232_Print("; read 0x");
+    RS232_PrintHex12(value);
+    RS232_Print(" with parity count ");
+    RS232_PrintHex4(parity);
   }
+  RS232_Print(".\n");
+}
 
-  STARTEvent;
+// Process the next frame decoded by the TCB0 ISR; returns 1 if a frame was
+// received
+uint8_t AVCLAN_readframe() {
+#ifdef AVCLAN_RX_DEFERRED
+  AVCLAN_rx_process();
+#endif
+  AVCLAN_printerror();
+  AVCLAN_capture_idle();
+
+  if (rxWrite == rxRead)
+    return 0;
 
-  if (printAllFrames)
-    AVCLAN_printframe(&frame, printBinary);
+  const AVCLAN_frame_t *frame = &rxQueue[rxMask(rxRead)];
+
+  if (printAllFrames && AVCLAN_capture_accept(frame)) {
+    AVCLAN_printframe(frame, rxTime[rxMask(rxRead)], printBinary);
+#ifdef AVCLAN_RX_DEFERRED
+    if (verbose && !printBinary) {
+      uint16_t margin = rxMargin[rxMask(rxRead)];
+      RS232_Print("Bit margin: 0x");
+      RS232_PrintHex8(*(((uint8_t *)&margin) + 1));
+      RS232_PrintHex8(*(((uint8_t *)&margin) + 0));
+      RS232_Print("\n");
+    }
+#endif
+  }
 
   if (!AVCLAN_ismuted())
-    AVCLAN_handleframe(&frame);
+    AVCLAN_handleframe(frame);
+
+  rxRead++; // Release the slot to the ISR
+
+  AVCLAN_calib_update();
 
   answerReq = cm_Null;
   return 1;
 }
 
-uint8_t AVCLAN_sendframe(const AVCLAN_frame_t *frame) {
-  if (AVCLAN_ismuted())
-    return 1;
+// Report a missing acknowledge; `txAcks` counts the acknowledge bits that were
+// received (0: addresses, 1: control, 2: length, 3+: data)
+static AVCLAN_sendresult_t AVCLAN_tx_nak() {
+  uint8_t field = txAcks;
+
+  switch (field) {
+    case 0:
+      stats.tx_nak_address++;
+      RS232_Print("Error NAK: Addresses\n");
+      return AVCLAN_SEND_NAK_ADDRESS;
+    case 1:
+      stats.tx_nak_control++;
+      RS232_Print("Error NAK: Control\n");
+      return AVCLAN_SEND_NAK_CONTROL;
+    case 2:
+      stats.tx_nak_length++;
+      RS232_Print("Error NAK: Message length\n");
+      return AVCLAN_SEND_NAK_LENGTH;
+    default:
+      stats.tx_nak_data++;
+      RS232_Print("Error NAK (Data: ");
+      RS232_PrintHex8(field - 3);
+      RS232_Print(")\n");
+      return AVCLAN_SEND_NAK_DATA;
+  }
+}
 
-  STOPEvent;
+// Start sending `frame`, already encoded in `s`; if `s` is NULL, the frame is
+// encoded into `txStream`
+static void AVCLAN_tx_start(const AVCLAN_frame_t *frame,
+                            const AVCLAN_txstream_t *s, AVCLAN_sent_t done) {
+  txFrame = frame;
+  txDone = done;
+
+  if (!s && !AVCLAN_ismuted() && !AVCLAN_encodeframe(&txStream, frame))
+    s = &txStream;
+  if (AVCLAN_ismuted() || !s) {
+    txState = TX_REFUSED;
+    return;
+  }
+  txArb = ((uint16_t)frame->broadcast << 12) | (frame->controller_addr & 0xFFF);
 
-  uint8_t parity = 0;
+  TX_STOPEvent;
+  AVCLAN_rx_pause();
 
   // wait for free line
   TCB1.CNT = 0;
@@ -675,126 +1982,216 @@ uint8_t AVCLAN_sendframe(const AVCLAN_frame_t *frame) {
   }
 
   // End of first loop could be due to bus being driven
-  TCB1.CNT = 0;
   if (!BUS_IS_IDLE) {
-    // Some other device started sending
-    // Can't yet simultaneously send and recieve to do proper CSMA/CD
-    return 1;
-
-    // Beginnings of CSMA/CD
-    // do {
-    //   if (TCB1.CNT >= (uint16_t)(AVCLAN_STARTBIT_LOGIC_0 * 1.2))
-    //     return 1; // Something's hinky; nothing is longer than the start bit
-    // } while (!BUS_IS_IDLE);
-    // if (TCB1.CNT <= (uint16_t)(AVCLAN_STARTBIT_LOGIC_0 * 0.8))
-    //   return 1; // Shouldn't be possible (waiting 2 bit lengths with idle
-    //   bus,
-    //             // then next bit should be a long one ie start)
-    // set_AVC_logic_for(1, AVCLAN_STARTBIT_LOGIC_1); // wait for end of start
-    // bit
-  } else {
-    AVCLAN_sendbit_start();
+    // Some other device started sending; its start bit hasn't been captured
+    // yet, so the frame is received as usual
+    stats.tx_busy++;
+    AVCLAN_rx_resume();
+    TX_STARTEvent;
+    txState = TX_LOST;
+    return;
   }
-  AVCLAN_sendbits((uint8_t *)&frame->broadcast, 1);
 
-  parity = AVCLAN_sendbits(&frame->controller_addr, 12);
-  AVCLAN_sendbit_parity(parity);
+  AVCLAN_tx_run(s);
+}
 
-  parity = AVCLAN_sendbits(&frame->peripheral_addr, 12);
-  AVCLAN_sendbit_parity(parity);
+/* Start sending `frame`. `done` (if not NULL) is called by `AVCLAN_tx_process`
+   with the result once the frame has finished, and `frame` must stay valid
+   until then. Returns 1 if the previous frame hasn't finished or been reported
+   yet.
 
-  if (frame->broadcast && !AVCLAN_readbit_ACK()) {
-    STARTEvent;
-    RS232_Print("Error NAK: Addresses\n");
+   With `AVCLAN_TX_TCD` the frame is clocked out by the TCD0 interrupt while
+   the main loop carries on; the bit-bang backend sends it before returning. */
+uint8_t AVCLAN_sendframe(const AVCLAN_frame_t *frame, AVCLAN_sent_t done) {
+  if (txState != TX_IDLE)
     return 1;
-  }
-
-  parity = AVCLAN_sendbits(&frame->control, 4);
-  AVCLAN_sendbit_parity(parity);
-
-  if (frame->broadcast && !AVCLAN_readbit_ACK()) {
-    STARTEvent;
-    RS232_Print("Error NAK: Control\n");
-    return 2;
-  }
 
-  parity = AVCLAN_sendbyte(&frame->length); // data length
-  AVCLAN_sendbit_parity(parity);
+  AVCLAN_tx_start(frame, NULL, done);
+  return 0;
+}
 
-  if (frame->broadcast && !AVCLAN_readbit_ACK()) {
-    STARTEvent;
-    RS232_Print("Error NAK: Message length\n");
-    return 3;
-  }
+// Report the frame that has finished sending, if any
+void AVCLAN_tx_process() {
+  AVCLAN_sendresult_t result;
 
-  for (uint8_t i = 0; i < frame->length; i++) {
-    parity = AVCLAN_sendbyte(&frame->data[i]);
-    AVCLAN_sendbit_parity(parity);
-    // Based on the µPD6708 datasheet, ACK bit for broadcast doesn't seem
-    // necessary (i.e. This deviates from the previous broadcast specific
-    // function that sent an extra `1` bit after each byte/parity)
-    if (frame->broadcast && !AVCLAN_readbit_ACK()) {
-      STARTEvent;
-      RS232_Print("Error NAK (Data: ");
-      RS232_PrintHex8(i);
-      RS232_Print(")\n");
-      return 4;
-    }
-    // else
-    //   AVCLAN_sendbit_1();
+  switch (txState) {
+    case TX_IDLE:
+    case TX_BUSY:
+      return;
+    case TX_DONE:
+      stats.tx_frames++;
+      stats.tx_bytes += txFrame->length;
+      if (printAllFrames && AVCLAN_capture_accept(txFrame))
+        AVCLAN_printframe(txFrame, txTime, printBinary);
+      result = AVCLAN_SEND_OK;
+      break;
+    case TX_NAK:
+      result = AVCLAN_tx_nak();
+      break;
+    case TX_LOST:
+      result = AVCLAN_SEND_LOST;
+      break;
+    default:
+      result = AVCLAN_SEND_REFUSED;
+      break;
   }
 
-  // back to read mode
-  STARTEvent;
-
-  if (printAllFrames)
-    AVCLAN_printframe(frame, printBinary);
-
-  return 0;
+  const AVCLAN_frame_t *frame = txFrame;
+  AVCLAN_sent_t done = txDone;
+  txState = TX_IDLE; // `done` may send the next frame
+  if (done)
+    done(frame, result);
 }
 
-const AVCLAN_frame_t *frameQueue[4];
+/* Transmit scheduler for queued responses
+
+   Each response has a priority and a deadline. `AVCLAN_respond` sends the
+   most urgent response that isn't backing off, earliest deadline first within
+   a priority. A NAKed response backs off for a random number of slots, which
+   doubles with every attempt, so that two nodes retrying after a collision
+   don't collide again. Responses past their deadline are no use to the head
+   unit and are dropped. */
+
+#define TXQUEUE_LEN 4
+
+// Lower values are more urgent
+typedef enum {
+  TX_PRIO_HANDSHAKE = 0, // LAN check, ping and function replies
+  TX_PRIO_REPORT,        // CD status reports
+} AVCLAN_txprio_t;
+
+// RTC ticks (~30.5 us)
+#define RTC_MS(ms) (uint16_t)((ms) * 32768UL / 1000)
+
+static const uint16_t txDeadline[] = {
+    [TX_PRIO_HANDSHAKE] = RTC_MS(50),
+    [TX_PRIO_REPORT] = RTC_MS(250),
+};
+#define TX_BACKOFF_SLOT RTC_MS(1)
+
+typedef struct AVCLAN_txentry_struct {
+  AVCLAN_txtemplate_t *tpl; // NULL if the entry is free
+  AVCLAN_txprio_t priority;
+  uint8_t attempts;
+  uint16_t deadline;  // RTC.CNT
+  uint16_t notBefore; // RTC.CNT; end of the backoff
+} AVCLAN_txentry_t;
+
+AVCLAN_txentry_t txQueue[TXQUEUE_LEN];
+AVCLAN_txentry_t *txSendingEntry;
+uint16_t txRandom;
+
+// Wrap-safe "`a` is later than `b`" for RTC timestamps
+static inline uint8_t rtcAfter(uint16_t a, uint16_t b) {
+  return (int16_t)(a - b) > 0;
+}
 
-static inline uint8_t qFull() {
-  return ((qWrite - qRead) == sizeof(frameQueue));
+// 16-bit Galois LFSR, seeded from the RTC on first use
+static uint16_t AVCLAN_random() {
+  if (txRandom == 0)
+    txRandom = rtcNow() | 1;
+  txRandom = (txRandom >> 1) ^ (-(txRandom & 1) & 0xB400);
+  return txRandom;
 }
 
-static inline uint8_t qMask(uint8_t pos) {
-  return pos & (sizeof(frameQueue) - 1);
+static void qDrop(AVCLAN_txentry_t *e) {
+  e->tpl = NULL;
+  qCount--;
 }
 
-uint8_t qPush(const AVCLAN_frame_t *frame) {
-  if (qFull())
+// Queue a response; if the queue is full, it replaces the least urgent
+// response, if that is less urgent. A template that is already queued has
+// been patched in place, so it isn't queued twice. Returns 1 if the response
+// wasn't queued.
+uint8_t qPush(AVCLAN_txtemplate_t *tpl, AVCLAN_txprio_t priority) {
+  AVCLAN_txentry_t *e = NULL;
+  for (uint8_t i = 0; i < TXQUEUE_LEN; i++) {
+    if (txQueue[i].tpl == tpl)
+      return 0;
+  }
+  for (uint8_t i = 0; i < TXQUEUE_LEN; i++) {
+    AVCLAN_txentry_t *q = &txQueue[i];
+    if (!q->tpl) {
+      e = q;
+      break;
+    }
+    if (q != txSendingEntry && q->priority > priority &&
+        (!e || q->priority > e->priority))
+      e = q;
+  }
+  if (qCount == TXQUEUE_LEN)
+    stats.tx_queue_full++;
+  if (!e)
     return 1;
+  if (e->tpl) {
+    stats.tx_dropped++;
+    qDrop(e);
+  }
 
-  frameQueue[qMask(qWrite++)] = frame;
+  uint16_t now = rtcNow();
+  e->tpl = tpl;
+  e->priority = priority;
+  e->attempts = 0;
+  e->deadline = now + txDeadline[priority];
+  e->notBefore = now;
+  qCount++;
 
   return 0;
 }
 
-const AVCLAN_frame_t *qPeek() {
-  if (qEmpty())
-    return NULL;
+// Most urgent response ready to be sent; drops expired responses
+static AVCLAN_txentry_t *qNext() {
+  uint16_t now = rtcNow();
+  AVCLAN_txentry_t *next = NULL;
+
+  for (uint8_t i = 0; i < TXQUEUE_LEN; i++) {
+    AVCLAN_txentry_t *e = &txQueue[i];
+    if (!e->tpl)
+      continue;
+    if (rtcAfter(now, e->deadline)) {
+      stats.tx_expired++;
+      qDrop(e);
+      continue;
+    }
+    if (rtcAfter(e->notBefore, now))
+      continue; // Backing off
+    if (!next || e->priority < next->priority ||
+        (e->priority == next->priority &&
+         rtcAfter(next->deadline, e->deadline)))
+      next = e;
+  }
+  return next;
+}
 
-  return frameQueue[qMask(qRead)];
+// A template can't be patched while it is on the bus; the head unit repeats
+// its request if it gets no reply
+static inline uint8_t AVCLAN_tpl_busy(const AVCLAN_txtemplate_t *t) {
+  return (txState == TX_BUSY && txFrame == &t->frame);
 }
 
-const AVCLAN_frame_t *qPop() {
-  if (qEmpty())
+// Set data byte `i` of a template to reply with it; NULL if it is being sent
+static AVCLAN_txtemplate_t *AVCLAN_tpl_get(AVCLAN_txtemplate_t *t, uint8_t i,
+                                           uint8_t value) {
+  if (AVCLAN_tpl_busy(t))
     return NULL;
 
-  return frameQueue[qMask(qRead++)];
+  AVCLAN_tpl_set(t, i, value);
+  return t;
 }
 
-uint8_t AVCLAN_handleframe(const AVCLAN_frame_t *frame) {
-  uint8_t respond = 0;
-  AVCLAN_frame_t *resp = malloc(sizeof(AVCLAN_frame_t));
-
-  if (!resp)
+// CD status report of type `report`; NULL if it is being sent
+static AVCLAN_txtemplate_t *AVCLAN_cdstatus(uint8_t report) {
+  if (AVCLAN_tpl_busy(&cdstatus_tpl))
     return NULL;
 
-  resp->controller_addr = DEVICE_ADDR;
-  resp->control = 0xF;
+  AVCLAN_tpl_set(&cdstatus_tpl, 2, report);
+  AVCLAN_tpl_write(&cdstatus_tpl, 3, &cd_status, sizeof(cd_status));
+  return &cdstatus_tpl;
+}
+
+uint8_t AVCLAN_handleframe(const AVCLAN_frame_t *frame) {
+  AVCLAN_txtemplate_t *resp = NULL;
+  AVCLAN_txprio_t priority = TX_PRIO_HANDSHAKE;
 
   if (!frame->broadcast) {
     // peripheral_addr will be 0xFFF or 0x1FF based on all currently known
@@ -804,22 +2201,16 @@ uint8_t AVCLAN_handleframe(const AVCLAN_frame_t *frame) {
       if (frame->data[1] == dev_COMM_CTRL) {
         switch (frame->data[2]) {
           case Lancheck_Scan_Req:
-            lancheck_resp[3] = Lancheck_Scan_Resp;
-            goto GROUPED;
+            resp = AVCLAN_tpl_get(&lancheck_tpl, 3, Lancheck_Scan_Resp);
+            break;
           case Lancheck_Req:
-            lancheck_resp[3] = Lancheck_Resp;
-            goto GROUPED;
+            resp = AVCLAN_tpl_get(&lancheck_tpl, 3, Lancheck_Resp);
+            break;
           case Lancheck_End_Req:
-            lancheck_resp[3] = Lancheck_End_Resp;
-            goto GROUPED;
+            resp = AVCLAN_tpl_get(&lancheck_tpl, 3, Lancheck_End_Resp);
+            break;
           default:
             break;
-          GROUPED:
-            resp->broadcast = UNICAST;
-            resp->peripheral_addr = HU_ADDR;
-            resp->length = sizeof(lancheck_resp);
-            resp->data = (uint8_t *)lancheck_resp;
-            respond = 1;
         }
       }
     } else if (frame->data[0] == dev_COMM_v1) {
@@ -832,19 +2223,10 @@ uint8_t AVCLAN_handleframe(const AVCLAN_frame_t *frame) {
               CD_Mode = stStop;
             break;
           case Ping_Req:
-            resp->broadcast = UNICAST;
-            resp->peripheral_addr = HU_ADDR;
-            resp->length = sizeof(ping_resp);
-            ping_resp[4] = frame->data[3];
-            resp->data = (uint8_t *)&ping_resp;
-            respond = 1;
+            resp = AVCLAN_tpl_get(&ping_tpl, 4, frame->data[3]);
             break;
           case List_Functions_Req:
-            resp->broadcast = UNICAST;
-            resp->peripheral_addr = HU_ADDR;
-            resp->length = sizeof(list_functions_resp);
-            resp->data = (uint8_t *)&list_functions_resp;
-            respond = 1;
+            resp = &list_functions_tpl;
             break;
           // case Restart_Lan:
           //   break;
@@ -861,33 +2243,29 @@ uint8_t AVCLAN_handleframe(const AVCLAN_frame_t *frame) {
             case dev_CD_CHANGER:
               switch (frame->data[3]) {
                 case Enable_Function_Req:
-                  function_change_resp[3] = Enable_Function_Resp;
+                  resp = AVCLAN_tpl_get(&function_change_tpl, 3,
+                                        Enable_Function_Resp);
                   cd_status.state = cd_SEEKING;
                   cd_status.flags2 = 0x80;
                   *cd_Time_Min = 0x00;
                   *cd_Time_Sec = 0x00;
                   CD_Mode = stPlay;
                   answerReq = cm_CDStatus;
-                  goto GROUPED2;
+                  break;
                 case Disable_Function_Req:
-                  function_change_resp[3] = Disable_Function_Resp;
+                  resp = AVCLAN_tpl_get(&function_change_tpl, 3,
+                                        Disable_Function_Resp);
                   CD_Mode = stStop;
                   cd_status.state = 0;
                   *cd_Time_Min = 0x00;
                   *cd_Time_Sec = 0x00;
                   answerReq = cm_CDStatus;
-                  goto GROUPED2;
+                  break;
                 // case 0x80:
                 //   act = Inserted_CD;
-                //   goto GROUPED;
+                //   break;
                 default:
                   break;
-                GROUPED2:
-                  resp->broadcast = UNICAST;
-                  resp->peripheral_addr = HU_ADDR;
-                  resp->length = sizeof(function_change_resp);
-                  resp->data = (uint8_t *)&function_change_resp;
-                  respond = 1;
               }
             default:
           }
@@ -897,24 +2275,18 @@ uint8_t AVCLAN_handleframe(const AVCLAN_frame_t *frame) {
           if (frame->data[2] == dev_CD_CHANGER) {
             switch (frame->data[3]) {
               case Request_Report:
-                cdstatus_resp[2] = Report;
-                goto GROUPED3;
+                resp = AVCLAN_cdstatus(Report);
+                break;
               case Request_Report2:
-                cdstatus_resp[2] = Report2;
-                goto GROUPED3;
+                resp = AVCLAN_cdstatus(Report2);
+                break;
               case Request_Loader2:
-                cdstatus_resp[2] = Report_Loader2;
-                goto GROUPED3;
+                resp = AVCLAN_cdstatus(Report_Loader2);
+                break;
               default:
                 break;
-              GROUPED3:
-                memcpy(&cdstatus_resp[3], &cd_status, sizeof(cd_status));
-                resp->broadcast = BROADCAST;
-                resp->peripheral_addr = 0x1FF;
-                resp->length = sizeof(cdstatus_resp);
-                resp->data = (uint8_t *)&cdstatus_resp;
-                respond = 1;
             }
+            priority = TX_PRIO_REPORT;
           }
           break;
         default:
@@ -922,31 +2294,52 @@ uint8_t AVCLAN_handleframe(const AVCLAN_frame_t *frame) {
     }
   }
 
-  if (!respond) {
-    free(resp);
-  } else {
-    qPush(resp);
+  if (resp)
+    qPush(resp, priority);
+
+  return (resp != NULL);
+}
+
+// Retry, requeue or drop the response that was just sent
+static void AVCLAN_respond_sent(const AVCLAN_frame_t *frame,
+                                AVCLAN_sendresult_t result) {
+  AVCLAN_txentry_t *e = txSendingEntry;
+  txSendingEntry = NULL;
+
+  switch (result) {
+    case AVCLAN_SEND_OK:
+      break;
+    case AVCLAN_SEND_LOST:
+      return; // Stays queued until the bus is free again
+    case AVCLAN_SEND_REFUSED:
+      stats.tx_dropped++;
+      break;
+    default:
+      if (++e->attempts < MAX_SEND_ATTEMPTS) {
+        stats.tx_retries++;
+        uint16_t slots = (1 << e->attempts) - 1;
+        e->notBefore =
+            rtcNow() + TX_BACKOFF_SLOT * (1 + (AVCLAN_random() & slots));
+        return;
+      }
+      // Sending failed all attempts; give up sending frame
+      stats.tx_dropped++;
+      break;
   }
 
-  return respond;
+  qDrop(e);
 }
 
+// Start sending the most urgent queued response, or the CD status; returns 1
+// if the previous frame is still being sent
 uint8_t AVCLAN_respond() {
-  uint8_t r = 0;
-  if (!qEmpty()) {
-    const AVCLAN_frame_t *resp = qPeek();
-    for (uint8_t i = 0; i < MAX_SEND_ATTEMPTS; i++) {
-      r = AVCLAN_sendframe(resp);
-      if (!r) { // Send succeeded
-        resp = qPop();
-        free((AVCLAN_frame_t *)resp);
-        break;
-      }
-    }
-    if (r) { // Sending failed all attempts; give up sending frame
-      resp = qPop();
-      free((AVCLAN_frame_t *)resp);
-    }
+  if (txState != TX_IDLE)
+    return 1;
+
+  AVCLAN_txentry_t *e = qNext();
+  if (e) {
+    txSendingEntry = e;
+    AVCLAN_tx_start(&e->tpl->frame, &e->tpl->stream, AVCLAN_respond_sent);
   } else {
     switch (answerReq) {
       case cm_Null:
@@ -959,57 +2352,419 @@ uint8_t AVCLAN_respond() {
   }
 
   answerReq = cm_Null;
-  return r;
+  return 0;
 }
 
-void AVCLAN_printframe(const AVCLAN_frame_t *frame, uint8_t binary) {
-  if (binary) {
-    uint8_t buffer[8];
-    buffer[0] = 0x10; // Data Link Escape, signaling binary data forthcoming
-    buffer[1] = frame->broadcast;
-
-    // Send addresses in big-endian order
-    buffer[2] = *(((uint8_t *)&frame->controller_addr) + 1);
-    buffer[3] = *(((uint8_t *)&frame->controller_addr) + 0);
-    buffer[4] = *(((uint8_t *)&frame->peripheral_addr) + 1);
-    buffer[5] = *(((uint8_t *)&frame->peripheral_addr) + 0);
-
-    buffer[6] = frame->control;
-    buffer[7] = frame->length;
-    RS232_sendbytes((uint8_t *)&buffer, 8);
-    RS232_sendbytes(frame->data, frame->length);
-
-    buffer[0] = 0x17; // End of transmission block
-    buffer[1] = 0x0D; // \r
-    buffer[2] = 0x0A; // \n
-    RS232_sendbytes((uint8_t *)&buffer, 3);
+static void AVCLAN_printstat(const char *name, uint16_t value) {
+  RS232_Print(name);
+  RS232_Print(" 0x");
+  RS232_PrintHex16(value);
+  RS232_Print("\n");
+}
+
+/* Binary capture records
+
+   In binary mode, frames and statistics are sent as records framed with COBS
+   (Consistent Overhead Byte Stuffing): an encoded record contains no 0x00
+   and is sent between two 0x00 delimiters, so the host splits the stream on
+   0x00 alone, whatever the payload, and text printed between records can't
+   run into them. Before encoding, a record is
+     <seq> <flags> <payload> [<CRC>]
+   - seq: counts records, so the host can tell how many it lost
+   - flags: bit 7 is set if the CRC is present (AVCLAN_CAPTURE_CRC), bits 6-5
+     are the record type, and for frames bit 4 is the broadcast bit and bits
+     3-0 the control nibble
+   - CAPTURE_FRAME payload: the timestamp of the start bit (see
+     `AVCLAN_timestamp`) as two little-endian uint16s, the count of 50 ms
+     periods and the microseconds into the period; the controller and
+     peripheral addresses packed big-endian into 3 bytes; then the data, whose
+     length is implied
+   - CAPTURE_STATS payload: AVCLAN_stats_t, RS232_RxOverrun, RS232_TxDropped,
+     then RS232_TxHeld and RS232_RxHeld in 1/1024 s, every counter as a
+     little-endian uint16
+   - CAPTURE_REPEAT payload: the seq of a CAPTURE_FRAME record, how many times
+     that frame was repeated in a row since, and the timestamps of the first
+     and (if more than one) the last repeat
+   - CRC: CRC-8 (polynomial 0x07, initial value 0) of seq through payload
+
+   Status frames are repeated all the time. With `captureDedup`, a frame equal
+   to one of the last CAPTURE_RECENT frames sent in full is counted into a
+   CAPTURE_REPEAT record instead. The record is sent before the next record of
+   any other kind, or once the run has been quiet for 50-100 ms, so records
+   stay in order. A frame is only referred to while its record is among the
+   last 256, so the host can't confuse its seq with a later one. */
+
+#define CAPTURE_FRAME  0
+#define CAPTURE_STATS  1
+#define CAPTURE_REPEAT 2
+
+#ifdef AVCLAN_CAPTURE_CRC
+  #define CAPTURE_CRC_bm 0x80
+#else
+  #define CAPTURE_CRC_bm 0
+#endif
+
+// seq, flags, the larger payload, CRC
+#define CAPTURE_MAX (2 + sizeof(AVCLAN_stats_t) + 8 + 1)
+_Static_assert(CAPTURE_MAX >= 2 + 4 + 3 + MAXMSGLEN + 1,
+               "CAPTURE_MAX is too small");
+// COBS needs an extra code byte for every 254 bytes
+_Static_assert(CAPTURE_MAX < 254, "Capture records need COBS block splitting");
+
+uint16_t captureSeq; // Sent modulo 256
+uint8_t captureBuf[1 + 1 + CAPTURE_MAX + 1]; // Delimiter, code, record, delim.
+uint8_t *captureOut;  // Next byte of `captureBuf`
+uint8_t *captureCode; // COBS code byte of the current block
+uint8_t captureCrc;
+
+static void AVCLAN_capture_put(uint8_t c) {
+  captureCrc = _crc8_ccitt_update(captureCrc, c);
+  if (c == 0) {
+    // Close the block; its code byte is the distance to this zero
+    *captureCode = captureOut - captureCode;
+    captureCode = captureOut++;
   } else {
-    RS232_PrintHex4(frame->broadcast);
+    *captureOut++ = c;
+  }
+}
 
-    RS232_Print(" 0x");
-    RS232_PrintHex12(frame->controller_addr);
-    RS232_Print(" 0x");
-    RS232_PrintHex12(frame->peripheral_addr);
+static void AVCLAN_capture_putbytes(const void *bytes, uint8_t len) {
+  const uint8_t *p = bytes;
+  while (len--)
+    AVCLAN_capture_put(*p++);
+}
 
-    RS232_Print(" 0x");
-    RS232_PrintHex4(frame->control);
+// The two halves of a timestamp; the ticks are sent as microseconds
+static void AVCLAN_capture_puttime(uint32_t time) {
+  uint16_t period = time >> 16;
+  uint16_t us = (uint32_t)(uint16_t)time * TIMESTAMP_PERIOD_US /
+                TIMESTAMP_TICKS;
 
-    RS232_Print(" 0x");
-    RS232_PrintHex4(frame->length);
+  AVCLAN_capture_putbytes(&period, sizeof(period));
+  AVCLAN_capture_putbytes(&us, sizeof(us));
+}
 
-    for (uint8_t i = 0; i < frame->length; i++) {
-      RS232_Print(" 0x");
-      RS232_PrintHex8(frame->data[i]);
+static void AVCLAN_capture_flush();
+
+static void AVCLAN_capture_begin(uint8_t flags) {
+  AVCLAN_capture_flush(); // Any run of repeats comes first
+
+  captureOut = captureBuf;
+  *captureOut++ = 0x00;
+  captureCode = captureOut++;
+  captureCrc = 0;
+
+  AVCLAN_capture_put(captureSeq++);
+  AVCLAN_capture_put(flags | CAPTURE_CRC_bm);
+}
+
+static void AVCLAN_capture_end() {
+#ifdef AVCLAN_CAPTURE_CRC
+  AVCLAN_capture_put(captureCrc);
+#endif
+  *captureCode = captureOut - captureCode;
+  *captureOut++ = 0x00;
+  RS232_sendbytes(captureBuf, captureOut - captureBuf);
+}
+
+#ifndef CAPTURE_RECENT
+  #define CAPTURE_RECENT 4
+#endif
+
+typedef struct AVCLAN_recent_struct {
+  uint16_t hash;
+  uint16_t seq; // Of the CAPTURE_FRAME record `frame` was sent in
+  AVCLAN_frame_t frame;
+} AVCLAN_recent_t;
+
+uint8_t captureDedup;
+AVCLAN_recent_t captureRecent[CAPTURE_RECENT];
+AVCLAN_recent_t *repeatFrame; // Of the run being counted, or NULL
+uint8_t repeatCount;
+uint32_t repeatFirst;
+uint32_t repeatLast;
+
+static uint16_t AVCLAN_frame_hash(const AVCLAN_frame_t *frame) {
+  uint16_t hash = 0xFFFF;
+  hash = _crc16_update(hash, frame->controller_addr);
+  hash = _crc16_update(hash, frame->controller_addr >> 8);
+  hash = _crc16_update(hash, frame->peripheral_addr);
+  hash = _crc16_update(hash, frame->peripheral_addr >> 8);
+  hash = _crc16_update(hash, (frame->broadcast << 4) | frame->control);
+  for (uint8_t i = 0; i < frame->length; i++)
+    hash = _crc16_update(hash, frame->data[i]);
+  return hash;
+}
+
+static uint8_t AVCLAN_frame_equal(const AVCLAN_frame_t *a,
+                                  const AVCLAN_frame_t *b) {
+  return a->controller_addr == b->controller_addr &&
+         a->peripheral_addr == b->peripheral_addr &&
+         a->broadcast == b->broadcast && a->control == b->control &&
+         a->length == b->length && !memcmp(a->data, b->data, a->length);
+}
+
+// Send the run of repeats being counted, if any
+static void AVCLAN_capture_flush() {
+  AVCLAN_recent_t *r = repeatFrame;
+  if (!r)
+    return;
+  repeatFrame = NULL;
+
+  AVCLAN_capture_begin(CAPTURE_REPEAT << 5);
+  AVCLAN_capture_put(r->seq);
+  AVCLAN_capture_put(repeatCount);
+  AVCLAN_capture_puttime(repeatFirst);
+  if (repeatCount > 1)
+    AVCLAN_capture_puttime(repeatLast);
+  AVCLAN_capture_end();
+}
+
+// Send a run of repeats that has gone quiet; called from the main loop
+static void AVCLAN_capture_idle() {
+  if (repeatFrame &&
+      (uint16_t)((AVCLAN_timestamp() >> 16) - (repeatLast >> 16)) >= 2)
+    AVCLAN_capture_flush();
+}
+
+// Count `frame` into a run of repeats; returns 0 if it must be sent in full
+static uint8_t AVCLAN_capture_repeat(const AVCLAN_frame_t *frame,
+                                     uint16_t hash, uint32_t time) {
+  AVCLAN_recent_t *r = captureRecent;
+  for (;; r++) {
+    if (r == &captureRecent[CAPTURE_RECENT])
+      return 0;
+    // Leave room for the flush below and a run of other frames' records
+    if (r->hash == hash && (uint16_t)(captureSeq - r->seq) < 250 &&
+        AVCLAN_frame_equal(&r->frame, frame))
+      break;
+  }
+
+  if (r != repeatFrame || repeatCount == UINT8_MAX) {
+    AVCLAN_capture_flush();
+    repeatFrame = r;
+    repeatCount = 0;
+    repeatFirst = time;
+  }
+  repeatCount++;
+  repeatLast = time;
+  return 1;
+}
+
+// Remember `frame`, just sent in full, in place of the oldest recent frame
+static void AVCLAN_capture_remember(const AVCLAN_frame_t *frame,
+                                    uint16_t hash) {
+  AVCLAN_recent_t *oldest = captureRecent;
+  for (uint8_t i = 1; i < CAPTURE_RECENT; i++) {
+    if ((uint16_t)(captureSeq - captureRecent[i].seq) >
+        (uint16_t)(captureSeq - oldest->seq))
+      oldest = &captureRecent[i];
+  }
+
+  oldest->hash = hash;
+  oldest->seq = captureSeq - 1;
+  oldest->frame = *frame;
+}
+
+// Send any run of repeats and forget the recent frames
+void AVCLAN_capture_reset() {
+  AVCLAN_capture_flush();
+  for (uint8_t i = 0; i < CAPTURE_RECENT; i++)
+    captureRecent[i].seq = captureSeq - 256;
+}
+
+// Print the health counters; the binary form is a CAPTURE_STATS record
+void AVCLAN_printstats(uint8_t binary) {
+  AVCLAN_stats_t s;
+  cli();
+  s = stats;
+  uint16_t uart_overrun = RS232_RxOverrun;
+  uint16_t uart_dropped = RS232_TxDropped;
+  RS232_FlowUpdate();
+  uint16_t uart_tx_held = RS232_TxHeld >> 5; // RTC ticks to 1/1024 s
+  uint16_t uart_rx_held = RS232_RxHeld >> 5;
+  sei();
+
+  if (binary) {
+    AVCLAN_capture_begin(CAPTURE_STATS << 5);
+    AVCLAN_capture_putbytes(&s, sizeof(s));
+    AVCLAN_capture_putbytes(&uart_overrun, sizeof(uart_overrun));
+    AVCLAN_capture_putbytes(&uart_dropped, sizeof(uart_dropped));
+    AVCLAN_capture_putbytes(&uart_tx_held, sizeof(uart_tx_held));
+    AVCLAN_capture_putbytes(&uart_rx_held, sizeof(uart_rx_held));
+    AVCLAN_capture_end();
+    return;
+  }
+
+  AVCLAN_printstat("RX frames", s.rx_frames);
+  AVCLAN_printstat("RX bytes", s.rx_bytes);
+  AVCLAN_printstat("RX dropped (slots full)", s.rx_overflow);
+  AVCLAN_printstat("RX pulses lost (FIFO full)", s.rx_pulses_lost);
+  AVCLAN_printstat("RX start bit stamps lost", s.rx_stamps_lost);
+  AVCLAN_printstat("RX filtered", s.rx_filtered);
+  AVCLAN_printstat("RX controller addr. parity", s.rx_err_controller_parity);
+  AVCLAN_printstat("RX peripheral addr. parity", s.rx_err_peripheral_parity);
+  AVCLAN_printstat("RX control parity", s.rx_err_control_parity);
+  AVCLAN_printstat("RX length parity", s.rx_err_length_parity);
+  AVCLAN_printstat("RX bad length", s.rx_err_length);
+  AVCLAN_printstat("RX data parity", s.rx_err_data_parity);
+  AVCLAN_printstat("RX bad start bit", s.rx_err_startbit);
+  AVCLAN_printstat("RX truncated", s.rx_err_truncated);
+  AVCLAN_printstat("TX frames", s.tx_frames);
+  AVCLAN_printstat("TX bytes", s.tx_bytes);
+  AVCLAN_printstat("TX bus busy", s.tx_busy);
+  AVCLAN_printstat("TX lost arbitration", s.tx_arb_lost);
+  AVCLAN_printstat("TX NAK addresses", s.tx_nak_address);
+  AVCLAN_printstat("TX NAK control", s.tx_nak_control);
+  AVCLAN_printstat("TX NAK length", s.tx_nak_length);
+  AVCLAN_printstat("TX NAK data", s.tx_nak_data);
+  AVCLAN_printstat("TX retries", s.tx_retries);
+  AVCLAN_printstat("TX dropped", s.tx_dropped);
+  AVCLAN_printstat("TX queue full", s.tx_queue_full);
+  AVCLAN_printstat("TX expired", s.tx_expired);
+  AVCLAN_printstat("Frame pool empty", s.pool_empty);
+  AVCLAN_printstat("Not logged (capture filter)", s.log_filtered);
+  AVCLAN_printstat("UART RX overrun", uart_overrun);
+  AVCLAN_printstat("UART TX dropped", uart_dropped);
+  AVCLAN_printstat("UART TX held by CTS (1/1024 s)", uart_tx_held);
+  AVCLAN_printstat("UART RX held by RTS (1/1024 s)", uart_rx_held);
+}
+
+void AVCLAN_resetstats() {
+  cli();
+  memset(&stats, 0, sizeof(stats));
+  rxOverflowReported = 0;
+  RS232_RxOverrun = 0;
+  RS232_TxDropped = 0;
+  RS232_FlowUpdate();
+  RS232_TxHeld = 0;
+  RS232_RxHeld = 0;
+  sei();
+}
+
+// Longest line of text: "B 0xCCC 0xPPP 0xC 0xLL", " 0xDD" per byte, "\r\n"
+#define FRAME_TEXT_MAX (22 + 5 * MAXMSGLEN + 2)
+
+char frameText[FRAME_TEXT_MAX];
+
+static inline char *AVCLAN_fmtsep(char *p, uint8_t compact) {
+  *p++ = ' ';
+  if (!compact) {
+    *p++ = '0';
+    *p++ = 'x';
+  }
+  return p;
+}
+
+// Render `frame` into `buf` as one line of text; returns its length
+static uint8_t AVCLAN_formatframe(char *buf, const AVCLAN_frame_t *frame,
+                                  uint8_t compact) {
+  char *p = buf;
+
+  *p++ = '0' + frame->broadcast;
+
+  p = AVCLAN_fmtsep(p, compact);
+  p = RS232_fmtHex4(p, frame->controller_addr >> 8);
+  p = RS232_fmtHex8(p, frame->controller_addr);
+  p = AVCLAN_fmtsep(p, compact);
+  p = RS232_fmtHex4(p, frame->peripheral_addr >> 8);
+  p = RS232_fmtHex8(p, frame->peripheral_addr);
+
+  p = AVCLAN_fmtsep(p, compact);
+  p = RS232_fmtHex4(p, frame->control);
+
+  p = AVCLAN_fmtsep(p, compact);
+  if (frame->length > 0x0f)
+    p = RS232_fmtHex4(p, frame->length >> 4);
+  p = RS232_fmtHex4(p, frame->length);
+
+  for (uint8_t i = 0; i < frame->length; i++) {
+    p = AVCLAN_fmtsep(p, compact);
+    p = RS232_fmtHex8(p, frame->data[i]);
+  }
+  *p++ = '\r';
+  *p++ = '\n';
+
+  return p - buf;
+}
+
+void AVCLAN_printframe(const AVCLAN_frame_t *frame, uint32_t time,
+                       uint8_t binary) {
+  if (binary) {
+    uint16_t hash = 0;
+    if (captureDedup) {
+      hash = AVCLAN_frame_hash(frame);
+      if (AVCLAN_capture_repeat(frame, hash, time))
+        return;
     }
-    RS232_Print("\n");
+
+    AVCLAN_capture_begin((CAPTURE_FRAME << 5) | (frame->broadcast << 4) |
+                         frame->control);
+    AVCLAN_capture_puttime(time);
+    AVCLAN_capture_put(frame->controller_addr >> 4);
+    AVCLAN_capture_put((frame->controller_addr << 4) |
+                       (frame->peripheral_addr >> 8));
+    AVCLAN_capture_put(frame->peripheral_addr);
+    AVCLAN_capture_putbytes(frame->data, frame->length);
+    AVCLAN_capture_end();
+
+    if (captureDedup)
+      AVCLAN_capture_remember(frame, hash);
+  } else {
+    RS232_sendbytes((const uint8_t *)frameText,
+                    AVCLAN_formatframe(frameText, frame, printCompact));
+  }
+}
+
+/* Frame pool
+
+   Frames that outlive the code that builds them, such as frames injected from
+   the host, come from a fixed pool rather than the heap: allocation takes
+   constant time and nothing can fragment. The firmware is linked without
+   malloc (see CMakeLists.txt). */
+
+#ifndef AVCLAN_FRAME_POOL
+  #define AVCLAN_FRAME_POOL 2
+#endif
+#if AVCLAN_FRAME_POOL < 1 || AVCLAN_FRAME_POOL > 255
+  #error "AVCLAN_FRAME_POOL must be between 1 and 255"
+#endif
+
+AVCLAN_frame_t framePool[AVCLAN_FRAME_POOL];
+uint8_t framePoolFree[AVCLAN_FRAME_POOL]; // Stack of free frames
+uint8_t framePoolNFree;
+
+static void AVCLAN_pool_init() {
+  for (uint8_t i = 0; i < AVCLAN_FRAME_POOL; i++)
+    framePoolFree[i] = i;
+  framePoolNFree = AVCLAN_FRAME_POOL;
+}
+
+// A free frame, or NULL if the pool is empty
+AVCLAN_frame_t *AVCLAN_frame_alloc() {
+  if (framePoolNFree == 0) {
+    stats.pool_empty++;
+    return NULL;
   }
+
+  return &framePool[framePoolFree[--framePoolNFree]];
+}
+
+// Return a frame from `AVCLAN_frame_alloc` to the pool
+void AVCLAN_frame_free(const AVCLAN_frame_t *frame) {
+  if (!frame)
+    return;
+
+  framePoolFree[framePoolNFree++] = frame - framePool;
 }
 
 AVCLAN_frame_t *AVCLAN_parseframe(const uint8_t *bytes, uint8_t len) {
-  if (len < sizeof(AVCLAN_frame_t))
+  // `len` is the index of the last byte of the record: a 7-byte header and at
+  // least one data byte
+  if (len < 7)
     return NULL;
 
-  AVCLAN_frame_t *frame = malloc(sizeof(AVCLAN_frame_t) + 1);
+  AVCLAN_frame_t *frame = AVCLAN_frame_alloc();
 
   if (!frame)
     return NULL;
@@ -1022,18 +2777,10 @@ AVCLAN_frame_t *AVCLAN_parseframe(const uint8_t *bytes, uint8_t len) {
   frame->control = *bytes++;
   frame->length = *bytes++;
 
-  if (frame->length <= (len - 8)) {
-    free(frame);
+  if (frame->length <= (len - 8) || frame->length > MAXMSGLEN) {
+    AVCLAN_frame_free(frame);
     return NULL;
   } else {
-    AVCLAN_frame_t *framedata =
-        realloc(frame, sizeof(AVCLAN_frame_t) + frame->length);
-    if (!framedata) {
-      free(frame);
-      return NULL;
-    }
-    frame = framedata;
-    frame->data = (uint8_t *)frame + sizeof(AVCLAN_frame_t);
     for (uint8_t i = 0; i < frame->length; i++) {
       frame->data[i] = *bytes++;
     }
@@ -1049,18 +2796,9 @@ void AVCLAN_updateCDStatus() {
       answerReq = cm_CDStatus;
     }
 
-    if (answerReq == cm_CDStatus) {
-      cdstatus_resp[2] = Report;
-      memcpy(&cdstatus_resp[3], &cd_status, sizeof(cd_status));
-
-      AVCLAN_frame_t status = {.broadcast = BROADCAST,
-                               .controller_addr = DEVICE_ADDR,
-                               .peripheral_addr = 0x1FF,
-                               .control = 0xF,
-                               .length = sizeof(cdstatus_resp),
-                               .data = (uint8_t *)&cdstatus_resp};
-
-      AVCLAN_sendframe(&status);
+    if (answerReq == cm_CDStatus && txState == TX_IDLE) {
+      AVCLAN_txtemplate_t *t = AVCLAN_cdstatus(Report);
+      AVCLAN_tx_start(&t->frame, &t->stream, NULL);
     }
   }
 }
@@ -1102,4 +2840,90 @@ void AVCLan_Measure() {
 
   STARTEvent;
 }
+
+// Decode the pulses sampled by the last `AVCLan_Measure`
+void AVCLan_Replay() { AVCLAN_rx_replay(pulses, 100); }
+
+// A frame printed the way `AVCLAN_printframe` did before `AVCLAN_formatframe`:
+// one call per field, every character queued on its own
+static void AVCLan_PrintFields(const AVCLAN_frame_t *frame) {
+  RS232_PrintHex4(frame->broadcast);
+
+  RS232_Print(" 0x");
+  RS232_PrintHex12(frame->controller_addr);
+  RS232_Print(" 0x");
+  RS232_PrintHex12(frame->peripheral_addr);
+
+  RS232_Print(" 0x");
+  RS232_PrintHex4(frame->control);
+
+  RS232_Print(" 0x");
+  RS232_PrintHex4(frame->length);
+
+  for (uint8_t i = 0; i < frame->length; i++) {
+    RS232_Print(" 0x");
+    RS232_PrintHex8(frame->data[i]);
+  }
+  RS232_Print("\n");
+}
+
+// CPU cycles since `start`, up to a TIMESTAMP_PERIOD_US
+static uint16_t AVCLan_Cycles(uint32_t start) {
+  uint32_t end = AVCLAN_timestamp();
+  uint16_t ticks = (uint16_t)end - (uint16_t)start;
+  if ((uint16_t)(end >> 16) != (uint16_t)(start >> 16))
+    ticks += TIMESTAMP_TICKS;
+  return ticks * 16;
+}
+
+/* Cycles and bytes to print a typical status frame as text: field by field
+   and waiting on the USART for every byte, as before the transmit buffer;
+   field by field into the transmit buffer; formatted into a buffer; and
+   formatted without the "0x"s. Bytes are counted as they are queued or sent.
+   Interrupts are off while timing, so the DRE interrupt sending the buffered
+   output isn't counted, and the line fits in the buffer, so only the first
+   case waits for the USART (the cycle count fits in 16 bits at the default
+   RS232_BAUD). */
+void AVCLan_BenchPrint() {
+  static const AVCLAN_frame_t frame = {
+      .broadcast = BROADCAST,
+      .controller_addr = HU_ADDR,
+      .peripheral_addr = 0xFFF,
+      .control = 0xF,
+      .length = 4,
+      .data = {0x11, 0x01, 0x45, 0x60},
+  };
+  uint16_t cycles[4];
+  uint8_t bytes[4];
+  uint32_t start;
+
+  for (uint8_t i = 0; i < 4; i++) {
+    RS232_Flush();
+    cli();
+    RS232_TxDirect = i == 0;
+    uint8_t count = RS232_TxCount();
+    start = AVCLAN_timestamp();
+    if (i < 2) {
+      AVCLan_PrintFields(&frame);
+    } else {
+      uint8_t len = AVCLAN_formatframe(frameText, &frame, i == 3);
+      RS232_sendbytes((const uint8_t *)frameText, len);
+    }
+    cycles[i] = AVCLan_Cycles(start);
+    bytes[i] = RS232_TxCount() - count;
+    RS232_TxDirect = 0;
+    sei();
+  }
+
+  static const char *const names[] = {"Blocking", "Fields", "Buffered",
+                                      "Compact"};
+  for (uint8_t i = 0; i < 4; i++) {
+    RS232_Print(names[i]);
+    RS232_Print(": cycles 0x");
+    RS232_PrintHex16(cycles[i]);
+    RS232_Print(", bytes 0x");
+    RS232_PrintHex8(bytes[i]);
+    RS232_Print("\n");
+  }
+}
 #endif
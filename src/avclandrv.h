@@ -46,6 +46,7 @@
 extern uint8_t printAllFrames;
 extern uint8_t verbose;
 extern uint8_t printBinary;
+extern uint8_t printCompact;
 
 typedef enum {
   cm_Null = 0,
@@ -165,20 +166,100 @@ typedef enum { stStop = 0, stPlay = 1 } cd_modes;
 
 typedef enum MSG_TYPE { BROADCAST = 0, UNICAST = 1 } MSG_TYPE_t;
 
+/* The payload is stored inline, so the same frame is the receive slot, the
+   input of `AVCLAN_handleframe`, a queued response and the source of a binary
+   record without copying or pointer chasing. The header packs into 5 bytes. */
 typedef struct AVCLAN_frame_struct {
-  MSG_TYPE_t broadcast;     // 0 for broadcast messages
-  uint16_t controller_addr; // formerly "master"
-  uint16_t peripheral_addr; // formerly "slave"
-  uint8_t control;
+  uint16_t controller_addr : 12; // formerly "master"
+  uint16_t broadcast : 1;        // MSG_TYPE_t; 0 for broadcast messages
+  uint16_t peripheral_addr : 12; // formerly "slave"
+  uint16_t control : 4;
   uint8_t length;
-  uint8_t *data;
+  uint8_t data[MAXMSGLEN];
 } AVCLAN_frame_t;
 
+typedef struct AVCLAN_filter_struct {
+  uint16_t controller_addr;
+  uint16_t controller_mask;
+  uint16_t peripheral_addr;
+  uint16_t peripheral_mask;
+} AVCLAN_filter_t;
+
+// Bus and driver health counters; see `AVCLAN_printstats`
+typedef struct AVCLAN_stats_struct {
+  uint16_t rx_frames;
+  uint16_t rx_bytes;
+  uint16_t rx_overflow; // No free receive slot
+  uint16_t rx_pulses_lost; // Pulse FIFO full (AVCLAN_RX_DEFERRED)
+  uint16_t rx_stamps_lost; // Start bit stamps full (AVCLAN_RX_DEFERRED)
+  uint16_t rx_filtered; // Rejected by the acceptance filter
+  uint16_t rx_err_controller_parity;
+  uint16_t rx_err_peripheral_parity;
+  uint16_t rx_err_control_parity;
+  uint16_t rx_err_length_parity;
+  uint16_t rx_err_length;
+  uint16_t rx_err_data_parity;
+  uint16_t rx_err_startbit;  // Too short or too long
+  uint16_t rx_err_truncated; // New start bit in the middle of a frame
+  uint16_t tx_frames;
+  uint16_t tx_bytes;
+  uint16_t tx_busy;     // Bus was taken before the start bit
+  uint16_t tx_arb_lost; // Another controller won arbitration
+  uint16_t tx_nak_address;
+  uint16_t tx_nak_control;
+  uint16_t tx_nak_length;
+  uint16_t tx_nak_data;
+  uint16_t tx_retries;
+  uint16_t tx_dropped; // Gave up after MAX_SEND_ATTEMPTS
+  uint16_t tx_queue_full;
+  uint16_t tx_expired; // Response missed its deadline
+  uint16_t pool_empty; // No free frame in the frame pool
+  uint16_t log_filtered; // Not logged because of the capture filter
+} AVCLAN_stats_t;
+
+extern AVCLAN_stats_t stats;
+extern uint8_t rxFilterEnabled;
+extern uint8_t calibEnabled;
+extern uint8_t captureDedup;
+
 void AVCLAN_init();
 void AVCLAN_muteDevice(uint8_t mute);
+uint32_t AVCLAN_timestamp();
 
 uint8_t AVCLAN_readframe();
-uint8_t AVCLAN_sendframe(const AVCLAN_frame_t *frame);
+void AVCLAN_rx_replay(const uint16_t *widths, uint8_t len);
+uint8_t AVCLAN_rx_addfilter(uint16_t controller_addr, uint16_t controller_mask,
+                            uint16_t peripheral_addr, uint16_t peripheral_mask);
+void AVCLAN_rx_clearfilters();
+uint8_t AVCLAN_capture_addfilter(const uint8_t *bytes, uint8_t len,
+                                 uint8_t exclude);
+void AVCLAN_capture_clearfilters();
+void AVCLAN_capture_printfilters();
+void AVCLAN_printstats(uint8_t binary);
+void AVCLAN_resetstats();
+void AVCLAN_calib_reset();
+void AVCLAN_calib_print();
+#ifdef AVCLAN_RX_DEFERRED
+void AVCLAN_rx_process();
+#endif
+typedef enum {
+  AVCLAN_SEND_OK = 0,
+  AVCLAN_SEND_NAK_ADDRESS,
+  AVCLAN_SEND_NAK_CONTROL,
+  AVCLAN_SEND_NAK_LENGTH,
+  AVCLAN_SEND_NAK_DATA,
+  // Another frame took the bus first; that frame is received as usual and ours
+  // can be sent again afterwards
+  AVCLAN_SEND_LOST,
+  AVCLAN_SEND_REFUSED, // Muted, or longer than MAXMSGLEN
+} AVCLAN_sendresult_t;
+
+// Called by `AVCLAN_tx_process` once a frame has been sent (or not)
+typedef void (*AVCLAN_sent_t)(const AVCLAN_frame_t *frame,
+                              AVCLAN_sendresult_t result);
+
+uint8_t AVCLAN_sendframe(const AVCLAN_frame_t *frame, AVCLAN_sent_t done);
+void AVCLAN_tx_process();
 
 // To allow inlining qEmpty and AVCLAN_responseNeeded
 #ifndef VAR_DECLS
@@ -189,20 +270,25 @@ uint8_t AVCLAN_sendframe(const AVCLAN_frame_t *frame);
   #define _INIT(x) = x
 #endif
 _DECL uint8_t answerReq _INIT(0);
-_DECL uint8_t qWrite _INIT(0);
-_DECL uint8_t qRead _INIT(0);
+_DECL uint8_t qCount _INIT(0);
 extern cd_modes CD_Mode;
 
-inline uint8_t qEmpty() { return (qWrite == qRead); }
+inline uint8_t qEmpty() { return (qCount == 0); }
 inline uint8_t AVCLAN_responseNeeded() { return (answerReq != 0) || !qEmpty(); }
 
 uint8_t AVCLAN_respond();
 
-void AVCLAN_printframe(const AVCLAN_frame_t *frame, uint8_t binary);
+void AVCLAN_printframe(const AVCLAN_frame_t *frame, uint32_t time,
+                       uint8_t binary);
+void AVCLAN_capture_reset();
+AVCLAN_frame_t *AVCLAN_frame_alloc();
+void AVCLAN_frame_free(const AVCLAN_frame_t *frame);
 AVCLAN_frame_t *AVCLAN_parseframe(const uint8_t *bytes, uint8_t len);
 
 #ifdef SOFTWARE_DEBUG
 void AVCLan_Measure();
+void AVCLan_Replay();
+void AVCLan_BenchPrint();
 #endif
 #ifdef HARDWARE_DEBUG
 void SetHighLow();
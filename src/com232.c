@@ -37,40 +37,356 @@
 #define USART_BAUD_RATE(BAUD_RATE)                                             \
   (uint16_t)((float)(F_CPU * 64 / (RXMODE_S * (float)BAUD_RATE)) + 0.5)
 
-uint8_t RS232_RxCharBuffer[25], RS232_RxCharBegin, RS232_RxCharEnd;
+/* Receive ring buffer
+
+   Single producer (the RXC interrupt), single consumer (the main loop): each
+   side only writes its own free-running index, so reading needs no `cli()`.
+   Characters that arrive while the buffer is full are counted and dropped. */
+
+#ifndef RS232_BAUD
+  #define RS232_BAUD 1200000
+#endif
+
+#ifndef RS232_RX_SIZE
+  #define RS232_RX_SIZE 64
+#endif
+#if (RS232_RX_SIZE & (RS232_RX_SIZE - 1)) != 0 || RS232_RX_SIZE > 128
+  #error "RS232_RX_SIZE must be a power of 2, at most 128"
+#endif
+
+uint8_t rxBuffer[RS232_RX_SIZE];
+volatile uint8_t rxHead;  // Written by the RXC interrupt
+volatile uint8_t rxTail;  // Written by the main loop
+uint16_t RS232_RxOverrun; // Characters lost by the USART or the buffer
+
+static inline uint8_t rxMask(uint8_t pos) { return pos & (RS232_RX_SIZE - 1); }
+
+/* Hardware flow control (RS232_FLOW_CONTROL)
+
+   RTS (PA3, output) and CTS (PC3, input) are active low. RTS is deasserted
+   once the receive buffer has RS232_RX_HEADROOM bytes left, room for what the
+   host's USB bridge sends before it reacts, and asserted again once the main
+   loop has emptied half of it. While the host deasserts CTS, the DRE interrupt
+   stops and the PORTC interrupt starts it again; the character already in the
+   USART still goes out. Output waits for CTS for up to RS232_CTS_TIMEOUT RTC
+   ticks; held longer than that, CTS means no host is connected (it is pulled
+   up), and output that doesn't fit is dropped until CTS is asserted again.
+   How long each side was held off is counted in RTC ticks (~30.5 us). */
+
+#ifndef RS232_RX_HEADROOM
+  #define RS232_RX_HEADROOM (RS232_RX_SIZE / 4)
+#endif
+#ifndef RS232_CTS_TIMEOUT
+  #define RS232_CTS_TIMEOUT 3277 // RTC ticks, 100 ms
+#endif
+
+#define RTS_PIN PIN3_bm // PORTA
+#define CTS_PIN PIN3_bm // PORTC
+
+uint32_t RS232_TxHeld; // RTC ticks the host held our output (CTS)
+uint32_t RS232_RxHeld; // RTC ticks we held the host's output (RTS)
+
+#ifdef RS232_FLOW_CONTROL
+volatile uint8_t txHeld;
+volatile uint8_t rxHeld;
+uint16_t txHeldSince; // RTC.CNT
+uint16_t rxHeldSince; // RTC.CNT
+
+uint8_t hostGone; // CTS was held past RS232_CTS_TIMEOUT and still is
+
+static inline uint8_t ctsAsserted() { return !(VPORTC.IN & CTS_PIN); }
+#endif
+
+// Whether to stop waiting for the host, which has held CTS for longer than
+// RS232_CTS_TIMEOUT. `since` (RTC.CNT) is kept by the waiting caller: when it
+// started waiting, or when CTS was last seen asserted.
+static uint8_t RS232_txBlocked(uint16_t *since) {
+#ifdef RS232_FLOW_CONTROL
+  uint16_t now = rtcNow();
+  if (ctsAsserted()) {
+    hostGone = 0;
+    *since = now;
+    return 0;
+  }
+  if (!hostGone && (uint16_t)(now - *since) > RS232_CTS_TIMEOUT)
+    hostGone = 1;
+  return hostGone;
+#else
+  (void)since;
+  return 0;
+#endif
+}
+
+// Count the time held so far; RTC.CNT wraps every 2 s, so the main loop calls
+// this often. Must be called with interrupts disabled.
+static void RS232_flow_update() {
+#ifdef RS232_FLOW_CONTROL
+  uint16_t now = rtcNow();
+  if (txHeld) {
+    RS232_TxHeld += (uint16_t)(now - txHeldSince);
+    txHeldSince = now;
+  }
+  if (rxHeld) {
+    RS232_RxHeld += (uint16_t)(now - rxHeldSince);
+    rxHeldSince = now;
+  }
+#endif
+}
+
+// `RS232_TxHeld` and `RS232_RxHeld` up to now
+void RS232_FlowUpdate(void) {
+  uint8_t sreg = SREG;
+  cli();
+  RS232_flow_update();
+  SREG = sreg;
+}
+
+/* Transmit ring buffer
+
+   Output is queued and sent by the DRE interrupt, so printing only blocks the
+   main loop when the buffer is full. With RS232_TX_DROP, nothing blocks:
+   output that doesn't fit is dropped and counted in RS232_TxDropped, and
+   `RS232_sendbytes` queues a binary record or line of text whole or not at
+   all. A line longer than the buffer (`AVCLAN_printframe` with long frames)
+   is the exception: once its first RS232_TX_SIZE bytes are queued, the rest
+   waits for room as it would without RS232_TX_DROP, which takes no longer
+   than sending them unless CTS holds them. */
+
+#ifndef RS232_TX_SIZE
+  #define RS232_TX_SIZE 128
+#endif
+#if (RS232_TX_SIZE & (RS232_TX_SIZE - 1)) != 0 || RS232_TX_SIZE > 128
+  #error "RS232_TX_SIZE must be a power of 2, at most 128"
+#endif
+
+uint8_t txBuffer[RS232_TX_SIZE];
+volatile uint8_t txHead; // Free-running; written by the main loop
+volatile uint8_t txTail; // Free-running; written by the DRE interrupt
+uint16_t RS232_TxDropped;
+
+static inline uint8_t txMask(uint8_t pos) { return pos & (RS232_TX_SIZE - 1); }
+
+static inline uint8_t txFree() {
+  return RS232_TX_SIZE - (uint8_t)(txHead - txTail);
+}
+
+// Wait for the next queued byte to be sent; with interrupts off, the DRE
+// interrupt can't run, so it is sent from here unless CTS holds it. Callers
+// check `RS232_txBlocked` so that they don't wait on CTS forever.
+static void RS232_drain() {
+  if (!(SREG & CPU_I_bm)) {
+#ifdef RS232_FLOW_CONTROL
+    if (!ctsAsserted())
+      return;
+#endif
+    loop_until_bit_is_set(USART0_STATUS, USART_DREIF_bp);
+    USART0_TXDATAL = txBuffer[txMask(txTail++)];
+  }
+}
+
+// Wait for room for `len` bytes; returns 1 if they have to be dropped
+static uint8_t RS232_reserve(uint8_t len) {
+  if (txFree() >= len)
+    return 0;
+#ifdef RS232_TX_DROP
+  RS232_TxDropped += len;
+  return 1;
+#else
+  uint16_t since = rtcNow();
+  while (txFree() < len) {
+    if (RS232_txBlocked(&since)) {
+      RS232_TxDropped += len;
+      return 1;
+    }
+    RS232_drain();
+  }
+  return 0;
+#endif
+}
+
+static inline void RS232_put(uint8_t c) {
+  txBuffer[txMask(txHead)] = c;
+  txHead++;
+}
+
+// Start the DRE interrupt on the queued bytes; while CTS holds us, the PORTC
+// interrupt does
+static inline void RS232_kick() {
+#ifdef RS232_FLOW_CONTROL
+  if (txHeld)
+    return;
+#endif
+  USART0.CTRLA |= USART_DREIE_bm;
+}
 
 void RS232_Init(void) {
-  RS232_RxCharBegin = RS232_RxCharEnd = 0;
+  rxHead = rxTail = 0;
+  txHead = txTail = 0;
 
   PORTMUX.CTRLB = PORTMUX_USART0_ALTERNATE_gc; // Use PA1/PA2 for TxD/RxD
 
   PORTA.DIRSET = PIN1_bm;
   PORTA.DIRCLR = PIN2_bm;
 
+  PORTA.OUTCLR = RTS_PIN; // Ready to receive; stays so without flow control
+  PORTA.DIRSET = RTS_PIN;
+
+#ifdef RS232_FLOW_CONTROL
+  txHeld = rxHeld = 0;
+  PORTC.DIRCLR = CTS_PIN;
+  PORTC.PIN3CTRL = PORT_PULLUPEN_bm | PORT_ISC_BOTHEDGES_gc; // Held if open
+#endif
+
   USART0.CTRLA = USART_RXCIE_bm;                 // Enable receive interrupts
   USART0.CTRLB = USART_RXEN_bm | USART_TXEN_bm | // Enable Rx/Tx and set receive
                  USART_RXMODE;                   // mode
   USART0.CTRLC = USART_CMODE_ASYNCHRONOUS_gc | USART_PMODE_DISABLED_gc |
                  USART_CHSIZE_8BIT_gc |
                  USART_SBMODE_1BIT_gc; // Async UART with 8N1 config
-  USART0.BAUD = USART_BAUD_RATE(1200000);
+  USART0.BAUD = USART_BAUD_RATE(RS232_BAUD);
 }
 
 ISR(USART0_RXC_vect) {
-  // Store received character to the End of Buffer
-  RS232_RxCharBuffer[RS232_RxCharEnd] = USART0_RXDATAL;
-  RS232_RxCharEnd++;
+  if (USART0_RXDATAH & USART_BUFOVF_bm) // Must be read before RXDATAL
+    RS232_RxOverrun++;
+
+  uint8_t c = USART0_RXDATAL;
+  uint8_t head = rxHead;
+  if ((uint8_t)(head - rxTail) == RS232_RX_SIZE) {
+    RS232_RxOverrun++;
+    return;
+  }
+  rxBuffer[rxMask(head)] = c;
+  rxHead = ++head; // Publish the character after it has been stored
+
+#ifdef RS232_FLOW_CONTROL
+  if (!rxHeld &&
+      (uint8_t)(head - rxTail) >= RS232_RX_SIZE - RS232_RX_HEADROOM) {
+    PORTA.OUTSET = RTS_PIN;
+    rxHeld = 1;
+    rxHeldSince = rtcNow();
+  }
+#endif
+}
+
+// Move up to `max` received characters into `buf`; returns how many
+uint8_t RS232_Read(uint8_t *buf, uint8_t max) {
+  uint8_t tail = rxTail;
+  uint8_t n = rxHead - tail;
+  if (n > max)
+    n = max;
+
+  for (uint8_t i = 0; i < n; i++)
+    buf[i] = rxBuffer[rxMask(tail++)];
+  rxTail = tail; // Hand the space back to the interrupt
+
+#ifdef RS232_FLOW_CONTROL
+  if (txHeld || rxHeld) {
+    uint8_t sreg = SREG;
+    cli();
+    RS232_flow_update();
+    if (rxHeld && (uint8_t)(rxHead - tail) <= RS232_RX_SIZE / 2) {
+      rxHeld = 0;
+      PORTA.OUTCLR = RTS_PIN;
+    }
+    SREG = sreg;
+  }
+#endif
+  return n;
+}
+
+ISR(USART0_DRE_vect) {
+  // CTRLA is also changed by the main loop, which may have set DREIE again
+  // after the buffer was drained
+  if (txTail == txHead) {
+    USART0.CTRLA &= ~USART_DREIE_bm;
+    return;
+  }
+#ifdef RS232_FLOW_CONTROL
+  if (!ctsAsserted()) {
+    USART0.CTRLA &= ~USART_DREIE_bm;
+    txHeld = 1;
+    txHeldSince = rtcNow();
+    return;
+  }
+#endif
+  USART0_TXDATAL = txBuffer[txMask(txTail++)];
 }
 
+#ifdef RS232_FLOW_CONTROL
+// CTS changed
+ISR(PORTC_PORT_vect) {
+  PORTC.INTFLAGS = CTS_PIN;
+  if (txHeld && ctsAsserted()) {
+    RS232_flow_update();
+    txHeld = 0;
+    USART0.CTRLA |= USART_DREIE_bm;
+  }
+}
+#endif
+
+#ifdef SOFTWARE_DEBUG
+uint8_t RS232_TxDirect; // Bypass the transmit buffer; see `RS232_TxCount`
+uint8_t txDirectBytes;
+
+// Bytes queued so far, modulo 256; with RS232_TxDirect set, bytes are sent the
+// way they were before the transmit buffer, waiting on DREIF for each one
+uint8_t RS232_TxCount(void) { return txHead + txDirectBytes; }
+#endif
+
 void RS232_SendByte(uint8_t Data) {
-  loop_until_bit_is_set(USART0_STATUS,
-                        USART_DREIF_bp); // wait for UART to become available
-  USART0_TXDATAL = Data;                 // send character
+#ifdef SOFTWARE_DEBUG
+  if (RS232_TxDirect) {
+    loop_until_bit_is_set(USART0_STATUS, USART_DREIF_bp);
+    USART0_TXDATAL = Data;
+    txDirectBytes++;
+    return;
+  }
+#endif
+  if (RS232_reserve(1))
+    return;
+  RS232_put(Data);
+  RS232_kick();
 }
 
 void RS232_sendbytes(const uint8_t *bytes, uint8_t len) {
-  for (uint8_t i = 0; i < len; i++) {
-    RS232_SendByte(bytes[i]);
+#ifdef SOFTWARE_DEBUG
+  if (RS232_TxDirect) {
+    while (len--)
+      RS232_SendByte(*bytes++);
+    return;
+  }
+#endif
+#ifdef RS232_TX_DROP
+  uint8_t first = len > RS232_TX_SIZE ? RS232_TX_SIZE : len;
+  if (RS232_reserve(first)) {
+    RS232_TxDropped += len - first;
+    return;
+  }
+  len -= first;
+  while (first--)
+    RS232_put(*bytes++);
+  RS232_kick();
+  if (!len)
+    return;
+#endif
+  uint16_t since = rtcNow();
+  while (len) {
+    uint8_t n = txFree();
+    if (n == 0) {
+      if (RS232_txBlocked(&since)) {
+        RS232_TxDropped += len;
+        return;
+      }
+      RS232_drain();
+      continue;
+    }
+    if (n > len)
+      n = len;
+    len -= n;
+    while (n--)
+      RS232_put(*bytes++);
+    RS232_kick();
   }
 }
 
@@ -83,14 +399,22 @@ void RS232_Print(const char *pBuf) {
   }
 }
 
-void RS232_PrintHex4(uint8_t Data) {
-  uint8_t Character = Data & 0x0f;
-  Character += '0';
-  if (Character > '9')
-    Character += 'A' - '0' - 10;
-  RS232_SendByte(Character);
+// Wait until everything queued has been handed to the USART, or until CTS has
+// been held past RS232_CTS_TIMEOUT
+void RS232_Flush(void) {
+  uint16_t since = rtcNow();
+  while (txTail != txHead) {
+    if (RS232_txBlocked(&since))
+      return;
+    RS232_drain();
+  }
+  loop_until_bit_is_set(USART0_STATUS, USART_DREIF_bp);
 }
 
+const char RS232_hex[16] = "0123456789ABCDEF";
+
+void RS232_PrintHex4(uint8_t Data) { RS232_SendByte(RS232_hex[Data & 0x0f]); }
+
 void RS232_PrintHex8(uint8_t Data) {
   RS232_PrintHex4(Data >> 4);
   RS232_PrintHex4(Data);
@@ -101,6 +425,11 @@ void RS232_PrintHex12(uint16_t x) {
   RS232_PrintHex8(*(((uint8_t *)&x) + 0));
 }
 
+void RS232_PrintHex16(uint16_t x) {
+  RS232_PrintHex8(*(((uint8_t *)&x) + 1));
+  RS232_PrintHex8(*(((uint8_t *)&x) + 0));
+}
+
 void RS232_PrintDec(uint8_t Data) {
   if (Data > 99) {
     RS232_SendByte('*');
@@ -25,17 +25,43 @@
 
 #include <stdint.h>
 
-extern uint8_t RS232_RxCharBuffer[25], RS232_RxCharBegin, RS232_RxCharEnd;
+extern uint16_t RS232_RxOverrun;
+extern uint16_t RS232_TxDropped;
+extern uint32_t RS232_TxHeld;
+extern uint32_t RS232_RxHeld;
 
 void RS232_Init(void);
+uint8_t RS232_Read(uint8_t *buf, uint8_t max);
 void RS232_Print_P(const char *str_addr);
 void RS232_SendByte(uint8_t Data);
 void RS232_sendbytes(const uint8_t *bytes, uint8_t len);
+void RS232_Flush(void);
+void RS232_FlowUpdate(void);
 void RS232_Print(const char *pBuf);
 void RS232_PrintHex4(uint8_t Data);
 void RS232_PrintHex8(uint8_t Data);
 void RS232_PrintHex12(uint16_t x);
+void RS232_PrintHex16(uint16_t x);
 void RS232_PrintDec(uint8_t Data);
 void RS232_PrintDec2(uint8_t Data);
 
+#ifdef SOFTWARE_DEBUG
+extern uint8_t RS232_TxDirect;
+uint8_t RS232_TxCount(void);
+#endif
+
+// Formatting into a buffer, to be sent in one go with `RS232_sendbytes`; each
+// returns the end of what it wrote
+extern const char RS232_hex[16];
+
+static inline char *RS232_fmtHex4(char *p, uint8_t x) {
+  *p++ = RS232_hex[x & 0x0f];
+  return p;
+}
+
+static inline char *RS232_fmtHex8(char *p, uint8_t x) {
+  p = RS232_fmtHex4(p, x >> 4);
+  return RS232_fmtHex4(p, x);
+}
+
 #endif // __COM232_H
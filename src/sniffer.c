@@ -40,6 +40,9 @@ const char const *offon[] = {"OFF", "ON"};
 void Setup();
 void general_GPIO_init();
 void print_help();
+void send_frame(const AVCLAN_frame_t *frame, AVCLAN_sent_t done);
+void free_frame(const AVCLAN_frame_t *frame, AVCLAN_sendresult_t result);
+void print_stack();
 
 int main() {
   uint8_t readSeq = 0;
@@ -47,33 +50,36 @@ int main() {
   uint8_t s_dig = 0;
   uint8_t s_c[2];
   uint8_t i;
-  uint8_t data_tmp[MAXMSGLEN];
   AVCLAN_frame_t msg = {
       .broadcast = UNICAST,
       .controller_addr = DEVICE_ADDR,
       .control = 0xF,
-      .data = data_tmp,
   };
+  uint8_t *data_tmp = msg.data; // Sequence read from the host
+  uint8_t record[7 + MAXMSGLEN + 1]; // Binary record: header, data, 0x17
+  uint8_t input[16];             // Chunk of serial input being handled
+  uint8_t inputLen = 0;
+  uint8_t inputPos = 0;
 
   Setup();
   print_help();
 
   while (1) {
 
-    if (!BUS_IS_IDLE) {
-      AVCLAN_readframe();
-    } else if (AVCLAN_responseNeeded()) {
+    // Frames are decoded in the background by the TCB0 ISR, and sent by the
+    // TCD0 ISR when AVCLAN_TX_TCD is enabled
+    AVCLAN_tx_process();
+    if (!AVCLAN_readframe() && BUS_IS_IDLE && AVCLAN_responseNeeded()) {
       AVCLAN_respond();
     }
 
-    // Key handler
-    if (RS232_RxCharEnd) {
-      cli();
-      readkey = RS232_RxCharBuffer[RS232_RxCharBegin];
-      RS232_RxCharBegin++;
-      if (RS232_RxCharBegin == RS232_RxCharEnd)  // if buffer is consumed
-        RS232_RxCharBegin = RS232_RxCharEnd = 0; // reset buffer
-      sei();
+    // Key handler; one key per pass, so the bus is serviced between keys
+    if (inputPos == inputLen) {
+      inputLen = RS232_Read(input, sizeof(input));
+      inputPos = 0;
+    }
+    if (inputPos < inputLen) {
+      readkey = input[inputPos++];
       switch (readkey) {
         case '?':
           print_help();
@@ -108,8 +114,9 @@ int main() {
           printAllFrames = 1;
           readSeq = 0;
           msg.broadcast = UNICAST;
+          msg.peripheral_addr = HU_ADDR;
           msg.length = s_len;
-          AVCLAN_sendframe(&msg);
+          send_frame(&msg, NULL);
           break;
         case 'Q': // Send broadcast
           printAllFrames = 1;
@@ -117,8 +124,7 @@ int main() {
           msg.broadcast = BROADCAST;
           msg.peripheral_addr = 0x1FF;
           msg.length = s_len;
-          AVCLAN_sendframe(&msg);
-          msg.peripheral_addr = HU_ADDR;
+          send_frame(&msg, NULL);
           break;
         case 'l': // Print received messages
           printAllFrames ^= 1;
@@ -126,6 +132,59 @@ int main() {
           RS232_Print(offon[printAllFrames]);
           RS232_Print("\n");
           break;
+        case 'i': // Add the sequence as a capture filter rule
+        case 'e':
+          printAllFrames = 1;
+          readSeq = 0;
+          if (AVCLAN_capture_addfilter(data_tmp, s_len, readkey == 'e'))
+            RS232_Print("ERR: Malformed rule, or too many rules\n");
+          break;
+        case 'n': // Clear the capture filter
+          AVCLAN_capture_clearfilters();
+          RS232_Print("Capture filter cleared\n");
+          break;
+        case 'f': // Print the capture filter
+          AVCLAN_capture_printfilters();
+          break;
+        case 'a': // Only receive frames passing the acceptance filter
+          rxFilterEnabled ^= 1;
+          RS232_Print("Acceptance filter: ");
+          RS232_Print(offon[rxFilterEnabled]);
+          RS232_Print("\n");
+          break;
+        case 'c': // Toggle compact text frames
+          printCompact ^= 1;
+          RS232_Print("Compact: ");
+          RS232_Print(offon[printCompact]);
+          RS232_Print("\n");
+          break;
+        case 'd': // Toggle repeat compression of binary frame records
+          captureDedup ^= 1;
+          AVCLAN_capture_reset();
+          RS232_Print("Repeat compression: ");
+          RS232_Print(offon[captureDedup]);
+          RS232_Print("\n");
+          break;
+        case 't': // Print bit timing calibration
+          AVCLAN_calib_print();
+          break;
+        case 'T': // Toggle bit timing calibration
+          calibEnabled ^= 1;
+          AVCLAN_calib_reset();
+          RS232_Print("Threshold calibration: ");
+          RS232_Print(offon[calibEnabled]);
+          RS232_Print("\n");
+          break;
+        case 's': // Print statistics
+          AVCLAN_printstats(printBinary);
+          break;
+        case 'u': // Print stack high-water mark
+          print_stack();
+          break;
+        case 'r': // Reset statistics
+          AVCLAN_resetstats();
+          RS232_Print("Statistics reset\n");
+          break;
         case 'k': // Echo input
           echoCharacters ^= 1;
           RS232_Print("Echo characters: ");
@@ -150,7 +209,7 @@ int main() {
           msg.broadcast = UNICAST;
           msg.controller_addr = DEVICE_ADDR;
           msg.peripheral_addr = HU_ADDR;
-          AVCLAN_sendframe(&msg);
+          send_frame(&msg, NULL);
           break;
         case 'p':
           CD_Mode = stPlay;
@@ -163,13 +222,19 @@ int main() {
           msg.broadcast = UNICAST;
           msg.controller_addr = DEVICE_ADDR;
           msg.peripheral_addr = HU_ADDR;
-          AVCLAN_sendframe(&msg);
+          send_frame(&msg, NULL);
           break;
 
 #ifdef SOFTWARE_DEBUG
         case 'M':
           AVCLan_Measure();
           break;
+        case 'P':
+          AVCLan_Replay();
+          break;
+        case 'g': // Not 'F', which is a hex digit in sequences
+          AVCLan_BenchPrint();
+          break;
 #endif
 
         case 0x10: // Signals binary sequence incoming
@@ -180,12 +245,12 @@ int main() {
             break;
           } // else (readSeq || readBinary); fall through to default
         case '\n':
-          if (readSeq && readBinary && data_tmp[s_len] == 0x17) {
+          if (readSeq && readBinary && s_len < sizeof(record) &&
+              record[s_len] == 0x17) {
             s_len--;
-            AVCLAN_frame_t *frame = AVCLAN_parseframe(data_tmp, s_len);
+            AVCLAN_frame_t *frame = AVCLAN_parseframe(record, s_len);
             if (frame) {
-              AVCLAN_sendframe(frame);
-              free(frame);
+              send_frame(frame, free_frame);
               readSeq = 0;
               readBinary = 0;
             }
@@ -195,8 +260,19 @@ int main() {
         default:
           if (readSeq) {
             if (readBinary) {
-              data_tmp[s_len++] = readkey;
+              if (s_len == sizeof(record)) {
+                readSeq = 0;
+                readBinary = 0;
+                RS232_Print("ERR: Sequence too long\n");
+                break;
+              }
+              record[s_len++] = readkey;
             } else {
+              if (s_len == MAXMSGLEN) {
+                readSeq = 0;
+                RS232_Print("ERR: Sequence too long\n");
+                break;
+              }
               s_c[s_dig] = readkey;
 
               s_dig++;
@@ -226,11 +302,69 @@ int main() {
             }
           }
       } // switch (readkey)
-    }   // if (RS232_RxCharEnd)
+    }   // if (inputPos < inputLen)
   }
   return 0;
 }
 
+// Start sending a frame from the REPL; the result is reported by
+// `AVCLAN_tx_process`
+void send_frame(const AVCLAN_frame_t *frame, AVCLAN_sent_t done) {
+  if (AVCLAN_sendframe(frame, done)) {
+    RS232_Print("ERR: Still sending the previous frame\n");
+    if (done)
+      done(frame, AVCLAN_SEND_REFUSED);
+  }
+}
+
+// Frames parsed from serial input go back to the pool once they have been sent
+void free_frame(const AVCLAN_frame_t *frame, AVCLAN_sendresult_t result) {
+  AVCLAN_frame_free(frame);
+}
+
+/* Stack high-water mark
+
+   Before `main`, the free SRAM between the end of .bss (`_end`) and the top
+   of the stack is painted with STACK_PAINT. The lowest byte that no longer
+   holds it is the deepest the stack has been, interrupts included. See
+   scripts/stack-report.py (the `stack_report` target) for the static bound. */
+#define STACK_PAINT 0xC5
+
+extern uint8_t _end;
+
+void paint_stack() __attribute__((naked, used, section(".init3")));
+void paint_stack() {
+  // No stack frame exists yet, so this can't be left to the compiler
+  __asm__ __volatile__("    ldi r30, lo8(_end)     \n"
+                       "    ldi r31, hi8(_end)     \n"
+                       "    ldi r24, %[paint]      \n"
+                       "    ldi r25, hi8(__stack)  \n"
+                       "    rjmp 2f                \n"
+                       "1:  st Z+, r24             \n"
+                       "2:  cpi r30, lo8(__stack)  \n"
+                       "    cpc r31, r25           \n"
+                       "    brlo 1b                \n" ::[paint] "M"(
+                           STACK_PAINT));
+}
+
+// Bytes between the end of .bss and the deepest the stack has been
+uint16_t stack_unused() {
+  const uint8_t *p = &_end;
+  while (p < (const uint8_t *)SP && *p == STACK_PAINT)
+    p++;
+  return p - &_end;
+}
+
+void print_stack() {
+  uint16_t unused = stack_unused();
+
+  RS232_Print("Stack used 0x");
+  RS232_PrintHex16(RAMEND + 1 - (uint16_t)&_end - unused);
+  RS232_Print(", never used 0x");
+  RS232_PrintHex16(unused);
+  RS232_Print("\n");
+}
+
 void Setup() {
   printAllFrames = 1;
   echoCharacters = 1;
@@ -285,12 +419,26 @@ void print_help() {
               "Q - send broadcast\n"
               "m - Toggle mute for mockingboard bus activity\n"
               "l - Toggle message logging\n"
+              "a - Toggle the acceptance filter (CD changer frames only)\n"
+              "i/e - Add the sequence as an include/exclude capture filter "
+              "rule\n"
+              "n - Clear the capture filter (log every frame)\n"
+              "f - Print the capture filter rules\n"
               "k - Toggle character echo\n"
+              "s - Print statistics (binary if binary is ON)\n"
+              "r - Reset statistics\n"
+              "u - Print stack high-water mark\n"
+              "t - Print bit threshold and pulse-width statistics\n"
+              "T - Toggle bit threshold calibration (and reset statistics)\n"
               "X/x - Turn binary ON or OFF, respectively\n"
+              "c - Toggle compact text frames (no \"0x\")\n"
+              "d - Toggle repeat compression of binary frames\n"
               "B - Beep\n"
               "v - Toggle verbose logging\n"
 #ifdef SOFTWARE_DEBUG
               "M - Measure bit-timing (pulse-widths and periods)\n"
+              "P - Decode the pulses sampled by 'M'\n"
+              "g - Benchmark printing frames as text\n"
 #endif
 #ifdef HARDWARE_DEBUG
               "1 - Hold High/low\n"
@@ -1,6 +1,9 @@
 #ifndef _TIMING_HPP_
 #define _TIMING_HPP_
 
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
 #define __CLKCTRL_PDIV_2X_gc  2
 #define __CLKCTRL_PDIV_4X_gc  4
 #define __CLKCTRL_PDIV_8X_gc  8
@@ -46,9 +49,25 @@
 #elif TCB_CLKSEL == TCB_CLKSEL_CLKDIV2_gc
   #define TCB_TICK (CPU_CYCLE * 2)
 #elif TCB_CLKSEL == TCB_CLKSEL_CLKTCA_gc
-  #error "Not implemented"
+  #error "Not implemented" // TCA0 keeps the timestamps
 #endif
 
+// RTC.CNT (~30.5 us ticks). Its two bytes are read through the RTC's shared
+// TEMP register, so an interrupt reading it in between would corrupt the
+// result; every reader goes through here.
+static inline uint16_t rtcNow() {
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t now = RTC.CNT;
+  SREG = sreg;
+  return now;
+}
+
+// TCA0 counts CLK_PER / 16 for timestamps, overflowing every 50 ms
+#define TIMESTAMP_PERIOD_US 50000
+#define TIMESTAMP_TICKS     (F_CPU / 16 / (1000000 / TIMESTAMP_PERIOD_US))
+#define TIMESTAMP_TICK      (CPU_CYCLE * 16)
+
 // Measured at ±0.02 μs @ F_CPU=20MHz, TCB_CLKSEL=TCB_CLKSEL_CLKDIV1_gc
 #define AVCLAN_STARTBIT_LOGIC_0 (169e3 / TCB_TICK)
 #define AVCLAN_STARTBIT_LOGIC_1 (20.6e3 / TCB_TICK)